@@ -7,11 +7,13 @@
  ***************************************************************************/
 
 #include "Mst.hpp"
+#include "common.h"
 
 // C includes (C++ namespace)
 #include <cassert>
 #include <cctype>
 #include <cerrno>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
 
@@ -21,8 +23,11 @@
 #endif
 
 // C++ includes.
+#include <algorithm>
+#include <deque>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 using std::u16string;
 using std::unique_ptr;
@@ -42,18 +47,409 @@ using namespace tinyxml2;
 
 // Invalid offset value.
 #define INVALID_OFFSET ~0U
+// Invalid arena offset value. (StrEntry::plc_off)
+#define INVALID_ARENA_OFFSET (~(size_t)0)
+
+// Maximum MST file size, unless LOAD_FLAG_LARGE is specified.
+#define MST_MAX_SIZE (16U*1024*1024)
+// Chunk size for reading MST files.
+#define MST_READ_CHUNK_SIZE (16U*1024*1024)
 
 Mst::Mst()
 	: m_version('1')
 	, m_isBigEndian(true)
-{ }
+	, m_largeTbl(false)
+	, m_lkupValid(false)
+	, m_lazySize(0)
+{
+	// Arena offset 0 is always an empty string.
+	m_arena.assign(2, 0);
+}
+
+/**
+ * Clear the string table.
+ */
+void Mst::clear(void)
+{
+	m_name.clear();
+	m_vStrTbl.clear();
+	m_vStrTblLarge.clear();
+	m_largeTbl = false;
+	m_arena.assign(2, 0);
+	m_vStrLkup.clear();
+	m_lkupValid = false;
+	m_version = '1';
+	m_isBigEndian = true;
+	clearLazy();
+}
+
+/**
+ * Append a UTF-8 string to an arena.
+ * @param arena	[in/out] Arena.
+ * @param str	[in] String.
+ * @param len	[in] Length of str, in characters.
+ * @return Arena offset of the string.
+ */
+size_t Mst::arenaAdd(vector<uint8_t> &arena, const char *str, size_t len)
+{
+	if (len == 0) {
+		// Use the shared empty string.
+		return 0;
+	}
+
+	const size_t off = arena.size();
+	// +1 for NULL terminator.
+	arena.resize(off + len + 1);
+	memcpy(&arena[off], str, len);
+	arena[off + len] = 0;
+	return off;
+}
+
+/**
+ * Append a UTF-16 string to an arena.
+ * The string will be aligned to a 2-byte boundary.
+ * @param arena	[in/out] Arena.
+ * @param str	[in] String.
+ * @param len	[in] Length of str, in characters.
+ * @return Arena offset of the string.
+ */
+size_t Mst::arenaAdd(vector<uint8_t> &arena, const char16_t *str, size_t len)
+{
+	if (len == 0) {
+		// Use the shared empty string.
+		return 0;
+	}
+
+	const size_t off = (arena.size() + 1) & ~(size_t)1;
+	// +1 for NULL terminator.
+	arena.resize(off + ((len + 1) * sizeof(char16_t)));
+	memcpy(&arena[off], str, len * sizeof(char16_t));
+	memset(&arena[off + (len * sizeof(char16_t))], 0, sizeof(char16_t));
+	return off;
+}
+
+/**
+ * Set a string table entry.
+ * If the entry doesn't fit in 32 bits, the string table
+ * is switched to 64-bit entries.
+ * @param index	[in] String index. (Must be in range.)
+ * @param entry	[in] String table entry.
+ */
+void Mst::setEntry(size_t index, const StrEntry &entry) const
+{
+	// All offsets and lengths are smaller than the arena.
+	// NOTE: ~0U is reserved for StrEntry32::plc_off.
+	if (!m_largeTbl && static_cast<uint64_t>(m_arena.size()) > UINT32_MAX) {
+		useLargeStrTbl();
+	}
+
+	if (m_largeTbl) {
+		m_vStrTblLarge[index] = entry;
+	} else {
+		m_vStrTbl[index] = StrEntry32(entry);
+	}
+}
+
+/**
+ * Resize the string table.
+ * New entries are empty.
+ * @param count New number of entries.
+ */
+void Mst::resizeStrTbl(size_t count) const
+{
+	if (m_largeTbl) {
+		m_vStrTblLarge.resize(count);
+	} else {
+		m_vStrTbl.resize(count);
+	}
+}
+
+/**
+ * Switch the string table to 64-bit entries.
+ */
+void Mst::useLargeStrTbl(void) const
+{
+	if (m_largeTbl) {
+		return;
+	}
+
+	m_vStrTblLarge.clear();
+	m_vStrTblLarge.reserve(m_vStrTbl.size());
+	for (auto iter = m_vStrTbl.cbegin(); iter != m_vStrTbl.cend(); ++iter) {
+		m_vStrTblLarge.emplace_back(*iter);
+	}
+	vector<StrEntry32>().swap(m_vStrTbl);
+	m_largeTbl = true;
+}
+
+/**
+ * Find a string by name.
+ * The name lookup table is rebuilt if necessary.
+ * @param name String name. (UTF-8)
+ * @return String index, or ~0 if not found.
+ */
+size_t Mst::findStr(const string &name) const
+{
+	const size_t count = strTblSize();
+	if (!m_lkupValid) {
+		// Rebuild the lookup table.
+		// NOTE: If lazy loading was used, all names will be decoded.
+		if (m_lazyData) {
+			for (size_t idx = 0; idx < count; idx++) {
+				lazyDecode(idx, LAZY_NAME);
+			}
+		}
+
+		m_vStrLkup.resize(count);
+		for (size_t idx = 0; idx < count; idx++) {
+			m_vStrLkup[idx] = static_cast<uint32_t>(idx);
+		}
+
+		// Stable sort, so the first string with a given name is found
+		// if there are duplicates.
+		std::stable_sort(m_vStrLkup.begin(), m_vStrLkup.end(),
+			[this](uint32_t a, uint32_t b) {
+				const StrEntry ea = getEntry(a);
+				const StrEntry eb = getEntry(b);
+				const int cmp = memcmp(arenaStr(ea.name_off), arenaStr(eb.name_off),
+					std::min(ea.name_len, eb.name_len));
+				return (cmp < 0 || (cmp == 0 && ea.name_len < eb.name_len));
+			});
+		m_lkupValid = true;
+	}
+
+	auto iter = std::lower_bound(m_vStrLkup.cbegin(), m_vStrLkup.cend(), name,
+		[this](uint32_t a, const string &b) {
+			const StrEntry ea = getEntry(a);
+			const int cmp = memcmp(arenaStr(ea.name_off), b.data(),
+				std::min(ea.name_len, b.size()));
+			return (cmp < 0 || (cmp == 0 && ea.name_len < b.size()));
+		});
+	if (iter == m_vStrLkup.cend()) {
+		// Not found.
+		return ~(size_t)0;
+	}
+	const StrEntry entry = getEntry(*iter);
+	if (entry.name_len != name.size() ||
+	    memcmp(arenaStr(entry.name_off), name.data(), name.size()) != 0)
+	{
+		// Not found.
+		return ~(size_t)0;
+	}
+	return *iter;
+}
+
+/**
+ * Find a NULL-terminated Shift-JIS string in MST data.
+ * @param pOffTblU8	[in] Start of the MST data, after the MST header.
+ * @param pOffTblEndU8	[in] End of the MST data.
+ * @param offset	[in] String offset, relative to pOffTblU8.
+ * @param span		[out] Shift-JIS string. (not including the NULL terminator)
+ * @return True on success; false if the offset is out of range.
+ */
+static bool findSJIS(const uint8_t *pOffTblU8, const uint8_t *pOffTblEndU8, uint32_t offset, TextSpan &span)
+{
+	if (offset >= static_cast<size_t>(pOffTblEndU8 - pOffTblU8)) {
+		// String is out of range.
+		return false;
+	}
+
+	span.str = reinterpret_cast<const char*>(&pOffTblU8[offset]);
+	span.len = strnlen(span.str, reinterpret_cast<const char*>(pOffTblEndU8) - span.str);
+	return true;
+}
+
+/**
+ * Read a NULL-terminated Shift-JIS string from MST data and convert it to UTF-8.
+ * @param pOffTblU8	[in] Start of the MST data, after the MST header.
+ * @param pOffTblEndU8	[in] End of the MST data.
+ * @param offset	[in] String offset, relative to pOffTblU8.
+ * @param str		[out] UTF-8 string.
+ * @return True on success; false if the offset is out of range.
+ */
+static bool readSJIS(const uint8_t *pOffTblU8, const uint8_t *pOffTblEndU8, uint32_t offset, string &str)
+{
+	TextSpan span;
+	if (!findSJIS(pOffTblU8, pOffTblEndU8, offset, span)) {
+		// String is out of range.
+		return false;
+	}
+
+	str = cpN_to_utf8(932, span.str, span.len);
+	return true;
+}
+
+/**
+ * Read a NULL-terminated UTF-16 string from MST data and convert it to host-endian.
+ * @param pOffTblU8	[in] Start of the MST data, after the MST header.
+ * @param pOffTblEndU8	[in] End of the MST data.
+ * @param offset	[in] String offset, relative to pOffTblU8.
+ * @param isBigEndian	[in] True if the MST data is big-endian.
+ * @param str		[out] Host-endian UTF-16 string.
+ * @return True on success; false if the offset is out of range.
+ */
+static bool readUTF16(const uint8_t *pOffTblU8, const uint8_t *pOffTblEndU8, uint32_t offset, bool isBigEndian, u16string &str)
+{
+	if (offset >= static_cast<size_t>(pOffTblEndU8 - pOffTblU8)) {
+		// String is out of range.
+		return false;
+	}
+
+	// TODO: Verify alignment.
+	const char16_t *const pMsgText = reinterpret_cast<const char16_t*>(&pOffTblU8[offset]);
+	const size_t maxLen = static_cast<size_t>(pOffTblEndU8 - pOffTblU8 - offset) / sizeof(char16_t);
+
+	// Find the end of the message text and convert it to host-endian.
+	static const bool hostIsBigEndian = (SYS_BYTEORDER == SYS_BIG_ENDIAN);
+	str = utf16_scan_copy(pMsgText, maxLen, (isBigEndian != hostIsBigEndian));
+	return true;
+}
+
+/**
+ * Range of messages to decode.
+ */
+struct Mst::MsgDecodeRange {
+	const uint8_t *pOffTblU8;	// Start of the MST data, after the MST header.
+	const uint8_t *pOffTblEndU8;	// End of the MST data.
+	bool isBigEndian;		// True if the MST data is big-endian.
+
+	size_t start;			// First message index.
+	size_t end;			// Last message index, plus one.
+
+	// Output
+	// NOTE: Only one of the string tables is set.
+	StrEntry32 *pStrTbl;		// String table. (preallocated)
+	StrEntry *pStrTblLarge;		// String table, 64-bit entries. (preallocated)
+	vector<uint8_t> *pArena;	// String arena.
+	size_t fail_idx;		// Index of the first out-of-range message, or ~0.
+	bool too_large;			// True if pArena is too large for 32-bit entries.
+
+	MsgDecodeRange()
+		: pOffTblU8(nullptr), pOffTblEndU8(nullptr), isBigEndian(true)
+		, start(0), end(0), pStrTbl(nullptr), pStrTblLarge(nullptr), pArena(nullptr)
+		, fail_idx(~(size_t)0), too_large(false)
+	{ }
+};
+
+/**
+ * Decode a range of messages.
+ * Decoding stops at the first message that's out of range.
+ * @param range Range of messages to decode.
+ */
+void Mst::decodeMsgRange(MsgDecodeRange *range)
+{
+	static const bool hostIsBigEndian = (SYS_BYTEORDER == SYS_BIG_ENDIAN);
+	const bool hostMatchesFileEndianness = (hostIsBigEndian == range->isBigEndian);
+
+	const uint8_t *const pOffTblU8 = range->pOffTblU8;
+	const uint8_t *const pOffTblEndU8 = range->pOffTblEndU8;
+	const WTXT_MsgPointer *const pOffTbl = reinterpret_cast<const WTXT_MsgPointer*>(pOffTblU8 + sizeof(WTXT_Header));
+	vector<uint8_t> &arena = *range->pArena;
+
+	const size_t data_size = static_cast<size_t>(pOffTblEndU8 - pOffTblU8);
+
+	// Messages are decoded in blocks.
+	// If the file endianness doesn't match the host, the message pointers
+	// are byteswapped one block at a time instead of one field at a time.
+	// All names and placeholder names in a block are converted to UTF-8
+	// in a single batch, which is then appended to the arena as-is.
+	static const size_t MSG_BLOCK_COUNT = 256;
+	WTXT_MsgPointer ptrBlock[MSG_BLOCK_COUNT];
+	vector<TextSpan> vNameSpans;
+	vNameSpans.reserve(MSG_BLOCK_COUNT * 2);
+	TextBatch names;
+
+	u16string text;
+	for (size_t blk_start = range->start; blk_start < range->end; blk_start += MSG_BLOCK_COUNT) {
+		const size_t n = std::min(MSG_BLOCK_COUNT, range->end - blk_start);
+		const WTXT_MsgPointer *pPtrs = &pOffTbl[blk_start];
+		if (!hostMatchesFileEndianness) {
+			__byte_swap_32_array(reinterpret_cast<uint32_t*>(ptrBlock),
+				reinterpret_cast<const uint32_t*>(pPtrs),
+				n * (sizeof(WTXT_MsgPointer) / sizeof(uint32_t)));
+			pPtrs = ptrBlock;
+		}
+
+		// Find the message names and placeholder names.
+		// If a message is out of range, decoding stops there.
+		vNameSpans.clear();
+		size_t blk_count = n;
+		for (size_t i = 0; i < n; i++) {
+			const WTXT_MsgPointer &ptr = pPtrs[i];
+			TextSpan name_span, plc_span;
+			if (!findSJIS(pOffTblU8, pOffTblEndU8, ptr.name_offset, name_span) ||
+			    ptr.text_offset >= data_size ||
+			    (ptr.placeholder_offset != 0 &&
+			     !findSJIS(pOffTblU8, pOffTblEndU8, ptr.placeholder_offset, plc_span)))
+			{
+				// MsgName, MsgText, or PlaceholderName is out of range.
+				blk_count = i;
+				break;
+			}
+			vNameSpans.push_back(name_span);
+			if (ptr.placeholder_offset != 0) {
+				vNameSpans.push_back(plc_span);
+			}
+		}
+
+		// Convert the names and add them to the arena.
+		// NOTE: Each converted name is already NULL-terminated.
+		cpN_to_utf8_batch(932, vNameSpans.data(), vNameSpans.size(), names);
+		const size_t names_base = arena.size();
+		arena.insert(arena.end(), names.data.cbegin(), names.data.cend());
+
+		size_t span_idx = 0;
+		for (size_t i = 0; i < blk_count; i++) {
+			const WTXT_MsgPointer &ptr = pPtrs[i];
+			StrEntry entry;
+
+			// NOTE: Saving entries for empty strings, too.
+			// Empty names use the arena's shared empty string.
+			entry.name_len = names.len(span_idx);
+			entry.name_off = (entry.name_len != 0 ? names_base + names.offsets[span_idx] : 0);
+			span_idx++;
+
+			// Get the placeholder name, if specified.
+			if (ptr.placeholder_offset != 0) {
+				entry.plc_len = names.len(span_idx);
+				entry.plc_off = (entry.plc_len != 0 ? names_base + names.offsets[span_idx] : 0);
+				span_idx++;
+			}
+
+			// Get the message text.
+			// NOTE: The offset was already checked.
+			readUTF16(pOffTblU8, pOffTblEndU8, ptr.text_offset, range->isBigEndian, text);
+			entry.text_off = arenaAdd(arena, text.data(), text.size());
+			entry.text_len = text.size();
+
+			if (range->pStrTblLarge) {
+				range->pStrTblLarge[blk_start + i] = entry;
+			} else {
+				range->pStrTbl[blk_start + i] = StrEntry32(entry);
+			}
+		}
+
+		if (!range->pStrTblLarge && static_cast<uint64_t>(arena.size()) > UINT32_MAX) {
+			// The decoded strings don't fit in 32-bit entries.
+			range->too_large = true;
+			return;
+		}
+
+		if (blk_count != n) {
+			// A message was out of range.
+			range->fail_idx = blk_start + blk_count;
+			return;
+		}
+	}
+}
 
 /**
  * Load an MST string table.
  * @param filename MST string table filename.
+ * @param flags Load flags. (See LoadFlags.)
  * @return 0 on success; negative POSIX error code on error.
  */
-int Mst::loadMST(const TCHAR *filename)
+int Mst::loadMST(const TCHAR *filename, unsigned int flags)
 {
 	if (!filename || !filename[0]) {
 		return -EINVAL;
@@ -64,41 +460,19 @@ int Mst::loadMST(const TCHAR *filename)
 		// Error opening the file.
 		return -errno;
 	}
-	int ret = loadMST(f_mst);
+	int ret = loadMST(f_mst, flags);
 	fclose(f_mst);
 	return ret;
 }
 
 /**
- * Load an MST string table.
- * @param fp MST string table file.
+ * Check an MST header and convert its fields to host-endian.
+ * @param mst_header	[in/out] MST header.
+ * @param flags		[in] Load flags. (See Mst::LoadFlags.)
  * @return 0 on success; negative POSIX error code on error.
  */
-int Mst::loadMST(FILE *fp)
+int Mst::checkMstHeader(MST_Header &mst_header, unsigned int flags)
 {
-	if (!fp) {
-		return -EINVAL;
-	}
-
-	int err;
-
-	// Clear the current string tables.
-	m_name.clear();
-	m_vStrTbl.clear();
-	m_mapPlaceholder.clear();
-	m_vStrLkup.clear();
-	m_version = '1';
-	m_isBigEndian = true;
-
-	// Read the MST header.
-	MST_Header mst_header;
-	size_t size = fread(&mst_header, 1, sizeof(mst_header), fp);
-	if (size != sizeof(mst_header)) {
-		// Read error.
-		// TODO: Store more comprehensive error information.
-		return -EIO;
-	}
-
 	// Check the BINA magic number.
 	if (mst_header.bina_magic != cpu_to_be32(BINA_MAGIC)) {
 		// TODO: Store more comprehensive error information.
@@ -111,10 +485,8 @@ int Mst::loadMST(FILE *fp)
 		// TODO: Store more comprehensive error information.
 		return -EIO;
 	}
-	m_version = mst_header.version;
-	m_isBigEndian = (mst_header.endianness == 'B');
 
-	if (m_isBigEndian) {
+	if (mst_header.endianness == 'B') {
 		mst_header.file_size		= be32_to_cpu(mst_header.file_size);
 		mst_header.doff_tbl_offset	= be32_to_cpu(mst_header.doff_tbl_offset);
 		mst_header.doff_tbl_length	= be32_to_cpu(mst_header.doff_tbl_length);
@@ -129,8 +501,9 @@ int Mst::loadMST(FILE *fp)
 		// Sanity check: File is too small.
 		// TODO: Store more comprehensive error information.
 		return -EIO;
-	} else if (mst_header.file_size > 16U*1024*1024) {
-		// Sanity check: Must be 16 MB or less.
+	} else if (mst_header.file_size > MST_MAX_SIZE && !(flags & LOAD_FLAG_LARGE)) {
+		// Sanity check: Must be 16 MB or less,
+		// unless large table mode is enabled.
 		// TODO: Store more comprehensive error information.
 		return -EIO;
 	}
@@ -142,27 +515,143 @@ int Mst::loadMST(FILE *fp)
 		return -EIO;
 	}
 
-	// Read the entire file.
-	// NOTE: Using a relative seek in case the file pointer was set by
-	// the caller to not be at the beginning of the file.
-	unique_ptr<uint8_t[]> mst_data(new uint8_t[mst_header.file_size]);
-	fseeko(fp, -(off_t)(sizeof(mst_header)), SEEK_CUR);
-	errno = 0;
-	size = fread(mst_data.get(), 1, mst_header.file_size, fp);
-	err = errno;
-	if (size != mst_header.file_size) {
-		// Short read.
+	return 0;
+}
+
+/**
+ * Check the WTXT message count against an MST header.
+ * The message pointer array must end before the differential offset table.
+ * @param mst_header	[in] MST header. (host-endian; see checkMstHeader())
+ * @param msg_tbl_count	[in] Message count. (host-endian)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int Mst::checkMsgTblCount(const MST_Header &mst_header, uint32_t msg_tbl_count)
+{
+	if ((uint64_t)sizeof(WTXT_Header) + ((uint64_t)msg_tbl_count * sizeof(WTXT_MsgPointer)) > mst_header.doff_tbl_offset) {
+		// Message count is out of range.
 		// TODO: Store more comprehensive error information.
-		if (err != 0) {
-			return -err;
+		return -EIO;
+	}
+	return 0;
+}
+
+/**
+ * Load an MST string table.
+ * @param fp MST string table file.
+ * @param flags Load flags. (See LoadFlags.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int Mst::loadMST(FILE *fp, unsigned int flags)
+{
+	if (!fp) {
+		return -EINVAL;
+	}
+
+	int err;
+
+	// Clear the current string tables.
+	clear();
+
+	// Read the MST header.
+	MST_Header mst_header_raw;
+	size_t size = fread(&mst_header_raw, 1, sizeof(mst_header_raw), fp);
+	if (size != sizeof(mst_header_raw)) {
+		// Read error.
+		// TODO: Store more comprehensive error information.
+		return -EIO;
+	}
+
+	// Check the MST header.
+	MST_Header mst_header = mst_header_raw;
+	err = checkMstHeader(mst_header, flags);
+	if (err != 0) {
+		return err;
+	}
+
+	// Read the rest of the file.
+	// NOTE: The header bytes that were already read are reused instead
+	// of seeking back, so this works with non-seekable streams, e.g. pipes.
+	// The buffer is allocated once, and the file is read in chunks.
+	const size_t file_size = mst_header.file_size;
+	unique_ptr<uint8_t[]> mst_data(new uint8_t[file_size]);
+	memcpy(mst_data.get(), &mst_header_raw, sizeof(mst_header_raw));
+	size_t pos = sizeof(mst_header_raw);
+	while (pos < file_size) {
+		const size_t chunk_size = std::min(file_size - pos, (size_t)MST_READ_CHUNK_SIZE);
+		errno = 0;
+		size = fread(&mst_data[pos], 1, chunk_size, fp);
+		err = errno;
+		if (size != chunk_size) {
+			// Short read.
+			// TODO: Store more comprehensive error information.
+			if (err != 0) {
+				return -err;
+			}
+			return -EIO;
 		}
+		pos += size;
+	}
+
+	return parseMST(mst_data.get(), mst_header, flags, &mst_data);
+}
+
+/**
+ * Load an MST string table from memory.
+ * The data is parsed in place. If LOAD_FLAG_LAZY is specified,
+ * a copy of the data is kept, so the caller's buffer does not
+ * need to remain valid after this function returns.
+ * @param data MST string table data.
+ * @param size Size of data, in bytes.
+ * @param flags Load flags. (See LoadFlags.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int Mst::loadMST(const uint8_t *data, size_t size, unsigned int flags)
+{
+	if (!data) {
+		return -EINVAL;
+	}
+
+	// Clear the current string tables.
+	clear();
+
+	if (size < sizeof(MST_Header)) {
+		// Too small.
+		// TODO: Store more comprehensive error information.
 		return -EIO;
 	}
 
+	// Check the MST header.
+	MST_Header mst_header;
+	memcpy(&mst_header, data, sizeof(mst_header));
+	int err = checkMstHeader(mst_header, flags);
+	if (err != 0) {
+		return err;
+	} else if (mst_header.file_size > size) {
+		// Short buffer.
+		// TODO: Store more comprehensive error information.
+		return -EIO;
+	}
+
+	return parseMST(data, mst_header, flags, nullptr);
+}
+
+/**
+ * Parse MST string table data.
+ * @param mst_data	[in] MST data, including the MST header.
+ * @param mst_header	[in] MST header. (host-endian; must have been checked)
+ * @param flags		[in] Load flags. (See LoadFlags.)
+ * @param pOwnedData	[in,opt] If mst_data is owned by the caller's unique_ptr, this points to it.
+ *                	         For LOAD_FLAG_LAZY, it will be taken; otherwise, mst_data will be copied.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int Mst::parseMST(const uint8_t *mst_data, const MST_Header &mst_header, unsigned int flags, unique_ptr<uint8_t[]> *pOwnedData)
+{
+	m_version = mst_header.version;
+	m_isBigEndian = (mst_header.endianness == 'B');
+
 	// Get pointers.
 	// NOTE: The differential offset table is NOT used for loading,
 	// since it's basically redundant information.
-	const WTXT_Header *const pWtxt = reinterpret_cast<const WTXT_Header*>(&mst_data[sizeof(mst_header)]);
 
 	// Calculate the offsets for each message.
 	// Reference: https://info.sonicretro.org/SCHG:Sonic_Forces/Formats/BINA
@@ -172,106 +661,466 @@ int Mst::loadMST(FILE *fp)
 	const uint8_t *const pOffTblU8 = &mst_data[sizeof(mst_header)];
 	const uint8_t *const pOffTblEndU8 = &mst_data[mst_header.file_size];
 	const WTXT_Header *const pWtxtHeader = reinterpret_cast<const WTXT_Header*>(pOffTblU8);
-	const WTXT_MsgPointer *pOffTbl = reinterpret_cast<const WTXT_MsgPointer*>(pOffTblU8 + sizeof(WTXT_Header));
-	const WTXT_MsgPointer *const pOffTblEnd = reinterpret_cast<const WTXT_MsgPointer*>(pOffTblEndU8);
 
 	static const bool hostIsBigEndian = (SYS_BYTEORDER == SYS_BIG_ENDIAN);
 	const bool hostMatchesFileEndianness = (hostIsBigEndian == m_isBigEndian);
 
+	// Get the message count.
+	// The message pointer array must end before the differential offset table.
+	uint32_t msg_tbl_count = pWtxtHeader->msg_tbl_count;
+	if (!hostMatchesFileEndianness) {
+		msg_tbl_count = __swab32(msg_tbl_count);
+	}
+	int err = checkMsgTblCount(mst_header, msg_tbl_count);
+	if (err != 0) {
+		return err;
+	}
+
 	// NOTE: First string is the string table name.
 	// Get that one first.
-	do {
-		uint32_t name_offset = pWtxtHeader->msg_tbl_name_offset;
+	uint32_t name_offset = pWtxtHeader->msg_tbl_name_offset;
+	if (!hostMatchesFileEndianness) {
+		name_offset = __swab32(name_offset);
+	}
+	// NOTE: If the string table name is out of range, it's left empty.
+	// TODO: Store more comprehensive error information.
+	readSJIS(pOffTblU8, pOffTblEndU8, name_offset, m_name);
+
+	if (flags & LOAD_FLAG_LARGE) {
+		// The decoded strings may be larger than 4 GB.
+		useLargeStrTbl();
+	}
+
+	if (flags & LOAD_FLAG_LAZY) {
+		// Lazy loading. Keep the raw MST data and only allocate
+		// empty string table entries. Strings will be decoded
+		// when they're first accessed.
+		resizeStrTbl(msg_tbl_count);
+		m_vLazyState.assign(msg_tbl_count, 0);
+		if (pOwnedData) {
+			m_lazyData = std::move(*pOwnedData);
+		} else {
+			m_lazyData.reset(new uint8_t[mst_header.file_size]);
+			memcpy(m_lazyData.get(), mst_data, mst_header.file_size);
+		}
+		m_lazySize = mst_header.file_size;
+
+		// Convert the message pointers to host-endian in place,
+		// so lazyDecode() doesn't have to byteswap them.
+		// NOTE: The WTXT header is not converted.
 		if (!hostMatchesFileEndianness) {
-			name_offset = __swab32(name_offset);
+			uint32_t *const pLazyOffTbl = reinterpret_cast<uint32_t*>(
+				&m_lazyData[sizeof(MST_Header) + sizeof(WTXT_Header)]);
+			__byte_swap_32_array(pLazyOffTbl, pLazyOffTbl,
+				msg_tbl_count * (sizeof(WTXT_MsgPointer) / sizeof(uint32_t)));
 		}
+		return 0;
+	}
 
-		const char *const pMsgName = reinterpret_cast<const char*>(&pOffTblU8[name_offset]);
-		if (pMsgName >= reinterpret_cast<const char*>(pOffTblEndU8)) {
-			// MsgName for the string table name is out of range.
-			// TODO: Store more comprehensive error information.
-			break;
+	// Load the actual strings.
+	// Each message is decoded into its own preallocated slot, so ranges
+	// of messages can be decoded in parallel if requested.
+	// The first range uses the main arena; other ranges use their own
+	// arenas, which are appended to the main arena afterwards.
+	resizeStrTbl(msg_tbl_count);
+	// NOTE: UTF-8 names may be up to 1.5x larger than Shift-JIS.
+	m_arena.reserve(mst_header.file_size + (mst_header.file_size / 2));
+	MsgDecodeRange range;
+	range.pOffTblU8 = pOffTblU8;
+	range.pOffTblEndU8 = pOffTblEndU8;
+	range.isBigEndian = m_isBigEndian;
+	if (m_largeTbl) {
+		range.pStrTblLarge = m_vStrTblLarge.data();
+	} else {
+		range.pStrTbl = m_vStrTbl.data();
+	}
+
+	size_t thread_count = 1;
+	if (flags & LOAD_FLAG_PARALLEL) {
+		// Don't bother with threads for small tables.
+		static const size_t MIN_MSGS_PER_THREAD = 1024;
+		thread_count = std::thread::hardware_concurrency();
+		if (thread_count > msg_tbl_count / MIN_MSGS_PER_THREAD) {
+			thread_count = msg_tbl_count / MIN_MSGS_PER_THREAD;
 		}
+		if (thread_count == 0) {
+			thread_count = 1;
+		}
+	}
 
-		size_t msgNameLen = strnlen(pMsgName, reinterpret_cast<const char*>(pOffTblEndU8) - pMsgName);
-		m_name = cpN_to_utf8(932, pMsgName, static_cast<int>(msgNameLen));
-	} while (0);
+	vector<MsgDecodeRange> vRanges(thread_count, range);
+	vector<vector<uint8_t> > vArenas(thread_count - 1, vector<uint8_t>(2, 0));
+	const size_t msgs_per_thread = (msg_tbl_count + thread_count - 1) / thread_count;
+	for (size_t i = 0; i < thread_count; i++) {
+		vRanges[i].start = std::min(i * msgs_per_thread, (size_t)msg_tbl_count);
+		vRanges[i].end = std::min(vRanges[i].start + msgs_per_thread, (size_t)msg_tbl_count);
+		vRanges[i].pArena = (i == 0 ? &m_arena : &vArenas[i - 1]);
+	}
 
-	// Temporary string for text.
-	u16string msgText;
+	if (thread_count > 1) {
+		vector<std::thread> vThreads;
+		vThreads.reserve(thread_count - 1);
+		for (size_t i = 1; i < thread_count; i++) {
+			vThreads.emplace_back(decodeMsgRange, &vRanges[i]);
+		}
+		decodeMsgRange(&vRanges[0]);
+		for (auto iter = vThreads.begin(); iter != vThreads.end(); ++iter) {
+			iter->join();
+		}
+	} else {
+		decodeMsgRange(&vRanges[0]);
+	}
 
-	// Load the actual strings.
-	// NOTE: Strings are NULL-terminated, so we have to determine the string length using strnlen().
-	size_t idx = 0;	// String index.
-	for (const WTXT_MsgPointer *p = pOffTbl; p < pOffTblEnd; p++, idx++) {
-		WTXT_MsgPointer ptr = *p;
-		if (!hostMatchesFileEndianness) {
-			ptr.name_offset	= __swab32(ptr.name_offset);
-			ptr.text_offset		= __swab32(ptr.text_offset);
-			ptr.placeholder_offset	= __swab32(ptr.placeholder_offset);
+	for (auto iter = vRanges.cbegin(); iter != vRanges.cend(); ++iter) {
+		if (iter->too_large) {
+			// The decoded strings are larger than 4 GB.
+			// LOAD_FLAG_LARGE is needed for this table.
+			clear();
+			return -EFBIG;
 		}
+	}
 
-		const char *const pMsgName = reinterpret_cast<const char*>(&pOffTblU8[ptr.name_offset]);
-		// TODO: Verify alignment.
-		const char16_t *pMsgText = reinterpret_cast<const char16_t*>(&pOffTblU8[ptr.text_offset]);
+	// If a message was out of range, the string table ends there.
+	// TODO: Store more comprehensive error information.
+	size_t count = msg_tbl_count;
+	for (auto iter = vRanges.cbegin(); iter != vRanges.cend(); ++iter) {
+		if (iter->fail_idx < count) {
+			count = iter->fail_idx;
+			break;
+		}
+	}
+	resizeStrTbl(count);
+
+	// Append the other ranges' arenas to the main arena.
+	for (size_t i = 1; i < thread_count && vRanges[i].start < count; i++) {
+		const vector<uint8_t> &arena = vArenas[i - 1];
+		// Keep UTF-16 strings aligned.
+		// The arena's shared empty string is skipped.
+		const size_t base = (m_arena.size() + 1) & ~(size_t)1;
+		m_arena.resize(base);
+		m_arena.insert(m_arena.end(), arena.cbegin() + 2, arena.cend());
+
+		// Rebase the string offsets.
+		// NOTE: Offset 0 is the shared empty string.
+		const size_t adj = base - 2;
+		const size_t end = std::min(vRanges[i].end, count);
+		for (size_t idx = vRanges[i].start; idx < end; idx++) {
+			StrEntry entry = getEntry(idx);
+			if (entry.name_off != 0)
+				entry.name_off += adj;
+			if (entry.text_off != 0)
+				entry.text_off += adj;
+			if (entry.plc_off != 0 && entry.plc_off != INVALID_ARENA_OFFSET)
+				entry.plc_off += adj;
+			setEntry(idx, entry);
+		}
+	}
 
-		const char *const pPlaceholderName = (ptr.placeholder_offset != 0
-			? reinterpret_cast<const char*>(&pOffTblU8[ptr.placeholder_offset])
-			: nullptr);
+	// The name lookup table will be built on demand.
+	m_lkupValid = false;
 
-		if (pMsgName >= reinterpret_cast<const char*>(pOffTblEndU8)) {
-			// MsgName is out of range.
-			// TODO: Store more comprehensive error information.
+	// We're done here.
+	return 0;
+}
+
+/**
+ * Get the next offset from the differential offset table.
+ * @param ppDiffOffTbl		[in/out] Pointer to current pointer into the differential offset table.
+ * 				         This is adjusted based on the differential offset data.
+ * @param pDiffOffTblEnd	[in] Pointer to the end of the differential offset table.
+ * @return Offset value, relative to the previous offset, or ~0U if end of table.
+ */
+uint32_t Mst::getNextDiffOff(const uint8_t **ppDiffOffTbl, const uint8_t *const pDiffOffTblEnd)
+{
+	const uint8_t *p = *ppDiffOffTbl;
+	if (p >= pDiffOffTblEnd) {
+		// End of table.
+		return INVALID_OFFSET;
+	}
+
+	// High two bits indicate the data length.
+	uint32_t diff;
+	switch (p[0] & 0xC0) {
+		default:
+		case 0x00:
+			// End of table.
+			return INVALID_OFFSET;
+		case 0x40:
+			// 6-bit value.
+			diff = (p[0] & 0x3F);
+			p++;
 			break;
-		} else if (pMsgText >= reinterpret_cast<const char16_t*>(pOffTblEndU8)) {
-			// MsgText is out of range.
-			// TODO: Store more comprehensive error information.
+		case 0x80:
+			// 14-bit value.
+			if (pDiffOffTblEnd - p < 2) {
+				// Truncated.
+				return INVALID_OFFSET;
+			}
+			diff = ((p[0] & 0x3F) << 8) | p[1];
+			p += 2;
 			break;
-		} else if (pPlaceholderName && pPlaceholderName >= reinterpret_cast<const char*>(pOffTblEndU8)) {
-			// PlaceholderName is out of range.
-			// TODO: Store more comprehensive error information.
+		case 0xC0:
+			// 30-bit value.
+			if (pDiffOffTblEnd - p < 4) {
+				// Truncated.
+				return INVALID_OFFSET;
+			}
+			diff = ((p[0] & 0x3F) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+			p += 4;
 			break;
+	}
+
+	*ppDiffOffTbl = p;
+	return (diff << 2);
+}
+
+/**
+ * Append an offset to a differential offset table.
+ * The shortest encoding that can represent the offset is used.
+ * @param vDiffOffTbl	[in/out] Differential offset table.
+ * @param diff		[in] Offset, relative to the previous offset. Must be a non-zero multiple of 4.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int Mst::appendDiffOff(vector<uint8_t> &vDiffOffTbl, uint32_t diff)
+{
+	if (diff == 0 || (diff & 3) != 0) {
+		// Offset cannot be encoded.
+		return -EINVAL;
+	}
+
+	// High two bits indicate the data length.
+	diff >>= 2;
+	if (diff <= 0x3F) {
+		// 6-bit value.
+		vDiffOffTbl.push_back(0x40 | diff);
+	} else if (diff <= 0x3FFF) {
+		// 14-bit value.
+		vDiffOffTbl.push_back(0x80 | (diff >> 8));
+		vDiffOffTbl.push_back(diff & 0xFF);
+	} else {
+		// 30-bit value.
+		// NOTE: diff was shifted right by 2, so it always fits.
+		vDiffOffTbl.push_back(0xC0 | (diff >> 24));
+		vDiffOffTbl.push_back((diff >> 16) & 0xFF);
+		vDiffOffTbl.push_back((diff >> 8) & 0xFF);
+		vDiffOffTbl.push_back(diff & 0xFF);
+	}
+	return 0;
+}
+
+/**
+ * Verify an MST string table's differential offset table.
+ * Every relocation is checked against the WTXT header and
+ * WTXT_MsgPointer fields, and each pointer must point to a
+ * NULL-terminated string in the text or names table.
+ * NOTE: This only checks the file's structure. Strings are not
+ * decoded, so a pointer to the wrong string is not detected.
+ * @param data		[in] MST string table data.
+ * @param size		[in] Size of data, in bytes.
+ * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+ * @return 0 if the table is valid; negative POSIX error code on error.
+ */
+int Mst::verifyMST(const uint8_t *data, size_t size, vector<string> *pVecErrs)
+{
+	if (!data) {
+		return -EINVAL;
+	} else if (size < sizeof(MST_Header)) {
+		if (pVecErrs) {
+			pVecErrs->push_back("File is too small.");
+		}
+		return -EIO;
+	}
+
+	// Check the MST header.
+	MST_Header mst_header;
+	memcpy(&mst_header, data, sizeof(mst_header));
+	// NOTE: Nothing is allocated here, so large tables are allowed.
+	int err = checkMstHeader(mst_header, LOAD_FLAG_LARGE);
+	if (err != 0) {
+		if (pVecErrs) {
+			pVecErrs->push_back("MST header is invalid.");
+		}
+		return err;
+	} else if (mst_header.file_size > size) {
+		if (pVecErrs) {
+			pVecErrs->push_back("File is truncated.");
+		}
+		return -EIO;
+	}
+
+	static const bool hostIsBigEndian = (SYS_BYTEORDER == SYS_BIG_ENDIAN);
+	const bool hostMatchesFileEndianness = (hostIsBigEndian == (mst_header.endianness == 'B'));
+
+	const uint8_t *const pOffTblU8 = &data[sizeof(mst_header)];
+	const WTXT_Header *const pWtxtHeader = reinterpret_cast<const WTXT_Header*>(pOffTblU8);
+	uint32_t msg_tbl_count = pWtxtHeader->msg_tbl_count;
+	if (!hostMatchesFileEndianness) {
+		msg_tbl_count = __swab32(msg_tbl_count);
+	}
+	err = checkMsgTblCount(mst_header, msg_tbl_count);
+	if (err != 0) {
+		if (pVecErrs) {
+			pVecErrs->push_back("WTXT message count is out of range.");
 		}
+		return err;
+	}
 
-		// Get the message name.
-		size_t msgNameLen = strnlen(pMsgName, reinterpret_cast<const char*>(pOffTblEndU8) - pMsgName);
-		string msgName = cpN_to_utf8(932, pMsgName, static_cast<int>(msgNameLen));
+	// Pointer fields that need relocations:
+	// - WTXT header: msg_tbl_name_offset
+	// - WTXT_MsgPointer: All non-zero fields
+	const uint32_t ptr_tbl_start = static_cast<uint32_t>(offsetof(WTXT_Header, msg_tbl_name_offset));
+	const uint32_t ptr_tbl_end = static_cast<uint32_t>(sizeof(WTXT_Header) + (msg_tbl_count * sizeof(WTXT_MsgPointer)));
+
+	// Read a pointer field.
+	auto readPtr = [=](uint32_t pos) -> uint32_t {
+		uint32_t val;
+		memcpy(&val, &pOffTblU8[pos], sizeof(val));
+		return (hostMatchesFileEndianness ? val : __swab32(val));
+	};
+
+	// Find the next non-zero pointer field, starting at `pos`.
+	auto nextPtr = [&](uint32_t pos) -> uint32_t {
+		// The WTXT magic and count fields are not pointers.
+		for (; pos < ptr_tbl_end; pos += sizeof(uint32_t)) {
+			if (pos < sizeof(WTXT_Header) && pos != ptr_tbl_start)
+				continue;
+			if (readPtr(pos) != 0)
+				return pos;
+		}
+		return INVALID_OFFSET;
+	};
+
+	// Is this pointer field a text offset?
+	auto isTextPtr = [=](uint32_t pos) -> bool {
+		return (pos >= sizeof(WTXT_Header) &&
+			(pos - sizeof(WTXT_Header)) % sizeof(WTXT_MsgPointer) == offsetof(WTXT_MsgPointer, text_offset));
+	};
+
+	// Text is stored before the Shift-JIS names and placeholders.
+	// Find the start of the names table: the name offset that has the
+	// fewest text offsets after it and name offsets before it, so a
+	// single bad pointer doesn't move the boundary.
+	vector<uint32_t> vTextPtrs, vNamePtrs;
+	for (uint32_t pos = nextPtr(ptr_tbl_start); pos != INVALID_OFFSET;
+	     pos = nextPtr(pos + sizeof(uint32_t)))
+	{
+		const uint32_t ptr = readPtr(pos);
+		if (ptr < ptr_tbl_end || ptr >= mst_header.doff_tbl_offset)
+			continue;
+		if (isTextPtr(pos)) {
+			vTextPtrs.push_back(ptr);
+		} else {
+			vNamePtrs.push_back(ptr);
+		}
+	}
+	std::sort(vTextPtrs.begin(), vTextPtrs.end());
+	std::sort(vNamePtrs.begin(), vNamePtrs.end());
+
+	uint32_t names_start = mst_header.doff_tbl_offset;
+	size_t best_misplaced = vNamePtrs.size();
+	for (size_t i = 0; i < vNamePtrs.size(); i++) {
+		if (i > 0 && vNamePtrs[i] == vNamePtrs[i-1])
+			continue;
+		const size_t texts_after = static_cast<size_t>(vTextPtrs.cend() -
+			std::lower_bound(vTextPtrs.cbegin(), vTextPtrs.cend(), vNamePtrs[i]));
+		if (texts_after + i < best_misplaced) {
+			names_start = vNamePtrs[i];
+			best_misplaced = texts_after + i;
+		}
+	}
 
-		// Find the end of the message text.
-		size_t len = 0;
-		if (m_isBigEndian) {
-			for (; pMsgText < reinterpret_cast<const char16_t*>(pOffTblEndU8); pMsgText++) {
-				if (*pMsgText == cpu_to_be16(0)) {
-					// Found the NULL terminator.
-					break;
+	char buf[256];
+	bool ok = true;
+	uint32_t expected_pos = nextPtr(ptr_tbl_start);	// Next pointer field to check.
+
+	// Check each relocation.
+	const uint8_t *pDiffOffTbl = &pOffTblU8[mst_header.doff_tbl_offset];
+	const uint8_t *const pDiffOffTblEnd = pDiffOffTbl + mst_header.doff_tbl_length;
+	uint32_t pos = 0;
+	unsigned int reloc_idx = 0;
+	for (;; reloc_idx++) {
+		const uint32_t diff = getNextDiffOff(&pDiffOffTbl, pDiffOffTblEnd);
+		if (diff == INVALID_OFFSET)
+			break;
+		pos += diff;
+
+		if (pos != expected_pos) {
+			// Relocation doesn't match the next pointer field.
+			if (pVecErrs) {
+				if (expected_pos == INVALID_OFFSET) {
+					snprintf(buf, sizeof(buf), "Relocation %u: Offset 0x%08X is not a pointer field.", reloc_idx, pos);
+				} else {
+					snprintf(buf, sizeof(buf), "Relocation %u: Offset 0x%08X does not match expected pointer field 0x%08X.", reloc_idx, pos, expected_pos);
+				}
+				pVecErrs->push_back(buf);
+			}
+			// Remaining relocations can't be matched.
+			return -EIO;
+		}
+
+		// Make sure the pointer is within the string data.
+		const uint32_t ptr = readPtr(pos);
+		if (ptr < ptr_tbl_end || ptr >= mst_header.doff_tbl_offset) {
+			if (pVecErrs) {
+				snprintf(buf, sizeof(buf), "Pointer field 0x%08X: Value 0x%08X is out of range.", pos, ptr);
+				pVecErrs->push_back(buf);
+			}
+			ok = false;
+		} else if (isTextPtr(pos)) {
+			// Text must be 2-byte aligned and NULL-terminated
+			// within the text table.
+			bool found = false;
+			if (!(ptr & 1)) {
+				for (uint32_t i = ptr; i + 1 < names_start; i += 2) {
+					if (pOffTblU8[i] == 0 && pOffTblU8[i+1] == 0) {
+						found = true;
+						break;
+					}
 				}
-				msgText += static_cast<char16_t>(be16_to_cpu(*pMsgText));
+			}
+			if (!found) {
+				if (pVecErrs) {
+					snprintf(buf, sizeof(buf), "Pointer field 0x%08X: Value 0x%08X is not a valid string in the text table.", pos, ptr);
+					pVecErrs->push_back(buf);
+				}
+				ok = false;
 			}
 		} else {
-			for (; pMsgText < reinterpret_cast<const char16_t*>(pOffTblEndU8); pMsgText++) {
-				if (*pMsgText == cpu_to_le16(0)) {
-					// Found the NULL terminator.
-					break;
+			// Names must be NULL-terminated within the names table.
+			if (ptr < names_start ||
+			    !memchr(&pOffTblU8[ptr], 0, mst_header.doff_tbl_offset - ptr))
+			{
+				if (pVecErrs) {
+					snprintf(buf, sizeof(buf), "Pointer field 0x%08X: Value 0x%08X is not a valid string in the names table.", pos, ptr);
+					pVecErrs->push_back(buf);
 				}
-				msgText += static_cast<char16_t>(le16_to_cpu(*pMsgText));
+				ok = false;
 			}
 		}
 
-		// Save the string table entry.
-		// NOTE: Saving entries for empty strings, too.
-		m_vStrTbl.emplace_back(std::make_pair(msgName, std::move(msgText)));
-		m_vStrLkup.insert(std::make_pair(std::move(msgName), idx));
+		expected_pos = nextPtr(pos + sizeof(uint32_t));
+	}
 
-		// Get the placeholder name, if specified.
-		if (pPlaceholderName) {
-			size_t placeholderNameLen = strnlen(pPlaceholderName, reinterpret_cast<const char*>(pOffTblEndU8) - pPlaceholderName);
-			string placeholderName = cpN_to_utf8(932, pPlaceholderName, static_cast<int>(placeholderNameLen));
-			m_mapPlaceholder.insert(std::make_pair(idx, std::move(placeholderName)));
+	// All pointer fields must have been relocated.
+	if (expected_pos != INVALID_OFFSET) {
+		if (pVecErrs) {
+			snprintf(buf, sizeof(buf), "Pointer field 0x%08X has no relocation.", expected_pos);
+			pVecErrs->push_back(buf);
 		}
+		return -EIO;
 	}
 
-	// We're done here.
-	return 0;
+	// Anything after the end of the table must be alignment padding.
+	for (; pDiffOffTbl < pDiffOffTblEnd; pDiffOffTbl++) {
+		if (*pDiffOffTbl != 0) {
+			if (pVecErrs) {
+				pVecErrs->push_back("Differential offset table has data after the end-of-table marker.");
+			}
+			return -EIO;
+		}
+	}
+
+	return (ok ? 0 : -EIO);
 }
 
 /**
@@ -328,17 +1177,61 @@ int Mst::loadXML(FILE *fp, vector<string> *pVecErrs)
 	}
 
 	// Clear the current string tables.
-	m_name.clear();
-	m_vStrTbl.clear();
-	m_mapPlaceholder.clear();
-	m_vStrLkup.clear();
-	m_version = '1';
-	m_isBigEndian = true;
+	clear();
+
+	// Parse the XML document.
+	XMLDocument xml;
+	if (ftello(fp) >= 0) {
+		// Seekable file.
+		xml.LoadFile(fp);
+	} else {
+		// Non-seekable stream, e.g. a pipe.
+		// TinyXML2 needs the file size, so read the entire stream first.
+		vector<char> xml_data;
+		char buf[4096];
+		size_t size;
+		while ((size = fread(buf, 1, sizeof(buf), fp)) > 0) {
+			xml_data.insert(xml_data.end(), buf, buf + size);
+		}
+		if (ferror(fp)) {
+			return -EIO;
+		}
+		xml.Parse(xml_data.data(), xml_data.size());
+	}
+	return parseXML(xml, pVecErrs);
+}
+
+/**
+ * Load an XML string table from memory.
+ * @param data		[in] XML data.
+ * @param size		[in] Size of data, in bytes.
+ * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+ * @return 0 on success; negative POSIX error code or positive TinyXML2 error code on error.
+ */
+int Mst::loadXML(const uint8_t *data, size_t size, vector<string> *pVecErrs)
+{
+	if (!data) {
+		return -EINVAL;
+	}
+
+	// Clear the current string tables.
+	clear();
 
 	// Parse the XML document.
 	XMLDocument xml;
-	int ret = xml.LoadFile(fp);
-	if (ret != 0) {
+	xml.Parse(reinterpret_cast<const char*>(data), size);
+	return parseXML(xml, pVecErrs);
+}
+
+/**
+ * Process a loaded XML document.
+ * @param xml		[in] XML document.
+ * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+ * @return 0 on success; negative POSIX error code or positive TinyXML2 error code on error.
+ */
+int Mst::parseXML(XMLDocument &xml, vector<string> *pVecErrs)
+{
+	if (xml.Error()) {
 		// Error parsing the XML document.
 		if (pVecErrs) {
 			const char *const errstr = xml.ErrorStr();
@@ -474,54 +1367,192 @@ int Mst::loadXML(FILE *fp, vector<string> *pVecErrs)
 
 		// Check for a duplicated message.
 		// If found, the original message will be replaced.
-		if (index < m_vStrTbl.size()) {
-			if (!m_vStrTbl[index].first.empty()) {
+		if (index < strTblSize()) {
+			if (getEntry(index).name_len != 0) {
 				// Found a duplicated message index.
+				// NOTE: The previous strings are left in the arena.
 				if (pVecErrs) {
 					snprintf(buf, sizeof(buf), "Line %d: Duplicate message index %u. This message will supercede the previous message.", xml_msg->GetLineNum(), index);
 					pVecErrs->push_back(buf);
 				}
-
-				// Remove the string from m_vStrLkup.
-				m_vStrLkup.erase(m_vStrTbl[index].first);
 			}
 		}
 
 		// Add the message to the main table.
-		if (index >= m_vStrTbl.size()) {
+		if (index >= strTblSize()) {
 			// Need to resize the main table.
-			m_vStrTbl.resize(index+1);
+			resizeStrTbl(index+1);
+		}
+		StrEntry entry = getEntry(index);
+		const size_t name_len = strlen(msg_name);
+		entry.name_off = arenaAdd(m_arena, msg_name, name_len);
+		entry.name_len = name_len;
+		// TODO: utf8_to_utf16() overload that takes `const char*`?
+		const u16string text = unescape(utf8_to_utf16(msg_text, strlen(msg_text)));
+		entry.text_off = arenaAdd(m_arena, text.data(), text.size());
+		entry.text_len = text.size();
+
+		// Placeholder name, if any.
+		// NOTE: If a duplicated message index has a placeholder,
+		// the original placeholder is kept.
+		const char *const placeholder_name = xml_msg->Attribute("placeholder");
+		if (placeholder_name && entry.plc_off == INVALID_ARENA_OFFSET) {
+			const size_t plc_len = strlen(placeholder_name);
+			entry.plc_off = arenaAdd(m_arena, placeholder_name, plc_len);
+			entry.plc_len = plc_len;
+		}
+		setEntry(index, entry);
+	}
+
+	// The name lookup table will be rebuilt on demand.
+	m_lkupValid = false;
+
+	// TODO: Check for missing message indexes.
+
+	// Document processed.
+	return 0;
+}
+
+/**
+ * Merge strings that are suffixes of other strings.
+ * Strings are NULL-terminated and addressed by offset, so a string
+ * that is a suffix of another string can point into its tail.
+ * @param vSpans	[in/out] Strings, in table order. Merged strings are removed.
+ * @param vRemap	[out] Original offset and new offset of each string, sorted by original offset.
+ * @param pinned	[in] Number of strings at the start of the table that must keep their offsets.
+ * @return New table size, in bytes.
+ */
+template<typename CharType, typename SpanType>
+static uint64_t mergeStringTails(vector<SpanType> &vSpans,
+	vector<std::pair<uint32_t, uint32_t> > &vRemap, size_t pinned)
+{
+	const size_t count = vSpans.size();
+
+	// Sort the strings by their reversed contents.
+	// If a string is a suffix of another string, it will be
+	// sorted immediately before that string or another string
+	// that shares the same suffix.
+	vector<size_t> vOrder(count);
+	for (size_t i = 0; i < count; i++) {
+		vOrder[i] = i;
+	}
+	std::sort(vOrder.begin(), vOrder.end(), [&vSpans](size_t a, size_t b) {
+		typedef std::reverse_iterator<const CharType*> rev_iter;
+		const SpanType &sa = vSpans[a];
+		const SpanType &sb = vSpans[b];
+		return std::lexicographical_compare(
+			rev_iter(sa.str + sa.len), rev_iter(sa.str),
+			rev_iter(sb.str + sb.len), rev_iter(sb.str));
+	});
+
+	// Find the string that owns each string's tail.
+	// Since a string is a suffix of the next string in sorted order
+	// if it's a suffix of any string, the owner can be propagated
+	// backwards through the sorted list.
+	vector<size_t> vOwner(count);
+	for (size_t i = count; i > 0; i--) {
+		const size_t idx = vOrder[i-1];
+		vOwner[idx] = idx;
+		if (i == count || idx < pinned)
+			continue;
+
+		const SpanType &cur = vSpans[idx];
+		const size_t next = vOrder[i];
+		const SpanType &nspan = vSpans[next];
+		if (cur.len <= nspan.len &&
+		    !memcmp(cur.str, nspan.str + (nspan.len - cur.len), cur.len * sizeof(CharType)))
+		{
+			// This string is a suffix of the next string.
+			vOwner[idx] = vOwner[next];
+		}
+	}
+
+	// Assign offsets to the strings that are written,
+	// keeping the original table order.
+	vector<uint32_t> vNewOffset(count);
+	uint64_t old_size = 0, new_size = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (vOwner[i] == i) {
+			vNewOffset[i] = static_cast<uint32_t>(new_size);
+			// +1 for NULL terminator.
+			new_size += (vSpans[i].len + 1) * sizeof(CharType);
 		}
-		m_vStrTbl[index].first = msg_name;
-		// TODO: utf8_to_utf16() overload that takes `const char*`?
-		m_vStrTbl[index].second = unescape(utf8_to_utf16(msg_text, strlen(msg_text)));
+	}
 
-		// Add the message to the lookup table.
-		m_vStrLkup.insert(std::make_pair(msg_name, index));
+	// Determine the new offsets of the merged strings.
+	// NOTE: This must be done before removing the merged strings,
+	// since the owners' lengths are needed.
+	vRemap.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		const size_t owner = vOwner[i];
+		const uint32_t new_offset = vNewOffset[owner] +
+			static_cast<uint32_t>((vSpans[owner].len - vSpans[i].len) * sizeof(CharType));
+		vRemap[i] = std::make_pair(static_cast<uint32_t>(old_size), new_offset);
+		// +1 for NULL terminator.
+		old_size += (vSpans[i].len + 1) * sizeof(CharType);
+	}
 
-		// Placeholder name, if any.
-		const char *const placeholder_name = xml_msg->Attribute("placeholder");
-		if (placeholder_name) {
-			m_mapPlaceholder.insert(std::make_pair(index, placeholder_name));
+	// Remove the merged strings.
+	size_t out_idx = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (vOwner[i] == i) {
+			vSpans[out_idx++] = vSpans[i];
 		}
 	}
+	vSpans.resize(out_idx);
+	return new_size;
+}
 
-	// TODO: Check for missing message indexes.
+/**
+ * Check that every string merged by mergeStringTails() can be read back.
+ * @param pTbl		[in] Serialized string table.
+ * @param tbl_size	[in] Size of pTbl, in bytes.
+ * @param vSpans	[in] Strings, in table order, before merging.
+ * @param vRemap	[in] Original offset and new offset of each string.
+ * @param bswap		[in] If true, pTbl is byteswapped relative to vSpans.
+ * @return True if every string is found at its new offset; false if not.
+ */
+template<typename CharType, typename SpanType>
+static bool checkStringTails(const uint8_t *pTbl, uint64_t tbl_size, const vector<SpanType> &vSpans,
+	const vector<std::pair<uint32_t, uint32_t> > &vRemap, bool bswap)
+{
+	assert(vSpans.size() == vRemap.size());
+	for (size_t i = 0; i < vSpans.size(); i++) {
+		const SpanType &span = vSpans[i];
+		const uint32_t offset = vRemap[i].second;
+		// +1 for NULL terminator.
+		if (offset + ((uint64_t)span.len + 1) * sizeof(CharType) > tbl_size) {
+			return false;
+		}
 
-	// Document processed.
-	return 0;
+		const CharType *const str = reinterpret_cast<const CharType*>(&pTbl[offset]);
+		for (size_t j = 0; j < span.len; j++) {
+			CharType c = span.str[j];
+			if (bswap) {
+				c = static_cast<CharType>(__swab16(static_cast<uint16_t>(c)));
+			}
+			if (str[j] != c) {
+				return false;
+			}
+		}
+		if (str[span.len] != 0) {
+			return false;
+		}
+	}
+	return true;
 }
 
 /**
  * Save the string table as MST.
  * @param filename MST filename.
+ * @param flags Save flags. (See SaveFlags.)
  * @return 0 on success; negative POSIX error code on error.
  */
-int Mst::saveMST(const TCHAR *filename) const
+int Mst::saveMST(const TCHAR *filename, unsigned int flags) const
 {
 	if (!filename || !filename[0]) {
 		return -EINVAL;
-	} else if (m_vStrTbl.empty()) {
+	} else if ((strTblSize() == 0)) {
 		return -ENODATA;	// TODO: Better error code?
 	}
 
@@ -530,328 +1561,402 @@ int Mst::saveMST(const TCHAR *filename) const
 		// Error opening the MST file.
 		return -errno;
 	}
-	int ret = saveMST(f_mst);
+	int ret = saveMST(f_mst, flags);
 	fclose(f_mst);
 	return ret;
 }
 
 /**
- * Save the string table as XML.
- * @param fp XML file.
+ * Save the string table as MST.
+ * @param fp MST file.
+ * @param flags Save flags. (See SaveFlags.)
  * @return 0 on success; negative POSIX error code on error.
  */
-int Mst::saveMST(FILE *fp) const
+int Mst::saveMST(FILE *fp, unsigned int flags) const
 {
-	if (m_vStrTbl.empty()) {
+	if ((strTblSize() == 0)) {
 		return -ENODATA;	// TODO: Better error code?
 	}
 
-	// MST header.
-	// NOTE: Parts of the header can't be filled in until
-	// the rest of the string table is handled.
-	MST_Header mst_header;
-	memset(&mst_header, 0, sizeof(mst_header));
-	mst_header.version = m_version;
-	mst_header.endianness = (m_isBigEndian ? 'B' : 'L');
-	mst_header.bina_magic = cpu_to_be32(BINA_MAGIC);
+	// Make sure all strings are decoded if lazy loading was used.
+	lazyDecodeAll();
+
+	// The MST file is built in two passes:
+	// 1. Plan the layout: Assign offsets to every string and
+	//    determine the exact size of each section.
+	// 2. Serialize all sections into a single buffer, which is
+	//    then written to the file in one call.
+
+	// Convert all of the message names and placeholder names
+	// to Shift-JIS in a single batch.
+	// TODO: Show warnings for strings with characters that
+	// can't be converted to Shift-JIS?
+	vector<TextSpan> vNameSpans;
+	const size_t str_count = strTblSize();
+	vNameSpans.reserve(str_count);
+	for (size_t idx = 0; idx < str_count; idx++) {
+		const StrEntry entry = getEntry(idx);
+		if (entry.name_len != 0) {
+			const TextSpan span = {arenaStr(entry.name_off), entry.name_len};
+			vNameSpans.push_back(span);
+		}
+		if (entry.plc_off != INVALID_ARENA_OFFSET) {
+			const TextSpan span = {arenaStr(entry.plc_off), entry.plc_len};
+			vNameSpans.push_back(span);
+		}
+	}
+	TextBatch sjis_names;
+	utf8_to_cpN_batch(932, vNameSpans.data(), vNameSpans.size(), sjis_names);
+
+	/** Pass 1: Plan the layout. **/
+
+	// Primary offset table.
+	// NOTE: Offsets are relative to the beginning of the text and
+	// names tables. The base addresses will be added in pass 2.
+	vector<WTXT_MsgPointer> vOffsetTbl(str_count);
+
+	// String pooling: Store each distinct string only once.
+	// Suffix sharing requires pooling.
+	const bool suffix = !!(flags & SAVE_FLAG_SUFFIX);
+	const bool pool = suffix || !!(flags & SAVE_FLAG_POOL);
+
+	// Names table contents, in order.
+	// vNameSpans is reused for this.
+	vNameSpans.clear();
+	uint64_t names_size = 0;
+
+	// Text table contents, in order.
+	vector<TextSpan16> vTextSpans;
+	vTextSpans.reserve(str_count);
+	uint64_t text_size = 0;
+
+	// Generated names for messages that don't have names.
+	// NOTE: std::deque doesn't move existing elements when
+	// adding new ones, so spans pointing to them stay valid.
+	std::deque<string> dqGenNames;
+
+	// String deduplication for the names table.
+	// If pooling, this is keyed by the Shift-JIS name as written
+	// to the names table. Otherwise, it's keyed by the UTF-8 name.
+	// TODO: Do we need to deduplicate *all* strings, or just the string table name.
+	unordered_map<string, uint32_t> map_nameDedupe;
 
-	// WTXT header.
-	// NOTE: Most of this header is filled out later.
-	WTXT_Header wtxt_header;
-	wtxt_header.magic = cpu_to_be32(WTXT_MAGIC);
-	wtxt_header.msg_tbl_name_offset = 0;
-	wtxt_header.msg_tbl_count = 0;
-
-	// Data vectors.
-	// NOTE: vOffsetTbl will have offsets relative to the
-	// beginning of each vMsgNames and vMsgText in the first run.
-	// The base addresses will be added in the second run.
-	vector<WTXT_MsgPointer> vOffsetTbl;	// Primary offset table.
-						// NOTE: If any field contains INVALID_OFFSET,
-						// it should be written as an actual zero.
-	vector<char16_t> vMsgText;	// Message text.
-	vector<char> vMsgNames;		// Message names.
+	// String pool for the text table. (Only if pooling.)
+	unordered_map<u16string, uint32_t> map_textPool;
 
 	// Differential offset table.
+	// Each entry is the distance from the previous pointer field
+	// to the next one, starting at the beginning of the WTXT header.
 	// This usually consists of 'AB' for strings with names and text,
 	// or 'AAA' for strings with names, text, and placeholders.
+	// - 'A': Skip 4 bytes.
+	// - 'B': Skip 8 bytes.
 	vector<uint8_t> vDiffOffTbl;
+	vDiffOffTbl.reserve((str_count * 3) + 2);
+	uint64_t last_ptr_pos = 0;
+
+	// Add a pointer field to the differential offset table.
+	auto addPtrField = [&vDiffOffTbl, &last_ptr_pos](uint64_t ptr_pos) {
+		assert(ptr_pos > last_ptr_pos);
+		int ret = appendDiffOff(vDiffOffTbl, static_cast<uint32_t>(ptr_pos - last_ptr_pos));
+		assert(ret == 0);
+		((void)ret);
+		last_ptr_pos = ptr_pos;
+	};
+
+	// Add a string to the names table.
+	auto addName = [&vNameSpans, &names_size](const char *str, size_t len) -> uint32_t {
+		const uint32_t offset = static_cast<uint32_t>(names_size);
+		const TextSpan span = {str, len};
+		vNameSpans.push_back(span);
+		// +1 for NULL terminator.
+		names_size += len + 1;
+		return offset;
+	};
+
+	// Add a string to the names table, if it isn't there already.
+	// key is the string used for deduplication.
+	string key;
+	auto addDedupedName = [&addName, &map_nameDedupe, &key](const char *str, size_t len) -> uint32_t {
+		auto map_iter = map_nameDedupe.find(key);
+		if (map_iter != map_nameDedupe.end()) {
+			// Found the string.
+			return map_iter->second;
+		}
 
-	// String deduplication for vMsgNames.
-	// TODO: Do we need to deduplicate *all* strings, or just the string table name.
-	unordered_map<string, size_t> map_nameDedupe;
-
-	// TODO: Better size reservations.
-	vOffsetTbl.reserve(m_vStrTbl.size());
-	vMsgText.reserve(m_vStrTbl.size() * 32);
-	vMsgNames.reserve(m_vStrTbl.size() * 32);
-	vDiffOffTbl.reserve(((((m_vStrTbl.size() * 2) + m_mapPlaceholder.size())) + 3) & ~(size_t)(3U));
+		// String not found, so cannot dedupe.
+		const uint32_t offset = addName(str, len);
+		// Add the string to the deduplication map.
+		map_nameDedupe.insert(std::make_pair(key, offset));
+		return offset;
+	};
 
 	// String table name.
 	// NOTE: While this is part of the names table, the offset is stored
 	// in the WTXT header, *not* the offset table.
-	{
-		if (!m_name.empty()) {
-			const size_t name_size = m_name.size();
-			// +1 for NULL terminator.
-			vMsgNames.resize(name_size + 1);
-			memcpy(vMsgNames.data(), m_name.c_str(), name_size+1);
-
-			// Add to the name deduplication map.
-			map_nameDedupe.insert(std::make_pair(m_name, 0));
-		} else {
-			// Empty string table name...
-			// TODO: Report a warning.
-			const char empty_name[] = "mst06_generic_name";
-			vMsgNames.resize(sizeof(empty_name));
-			memcpy(vMsgNames.data(), empty_name, sizeof(empty_name));
+	addPtrField(offsetof(WTXT_Header, msg_tbl_name_offset));
+	if (!m_name.empty()) {
+		addName(m_name.data(), m_name.size());
+		// Add to the name deduplication map.
+		map_nameDedupe.insert(std::make_pair(m_name, 0));
+	} else {
+		// Empty string table name...
+		// TODO: Report a warning.
+		static const char empty_name[] = "mst06_generic_name";
+		addName(empty_name, sizeof(empty_name)-1);
+		if (pool) {
+			map_nameDedupe.insert(std::make_pair(string(empty_name, sizeof(empty_name)-1), 0));
 		}
-
-		// Differential offset table initialization:
-		// - 'A': Skip "WTXT"
-		// - 'B': Skip string table name offset and count.
-		vDiffOffTbl.push_back('A');
-		vDiffOffTbl.push_back('B');
 	}
 
-	// Host endianness.
-	static const bool hostIsBigEndian = (SYS_BYTEORDER == SYS_BIG_ENDIAN);
-	const bool hostMatchesFileEndianness = (hostIsBigEndian == m_isBigEndian);
-
-	size_t idx = 0;
-	u16string msg_text;
-	for (auto iter = m_vStrTbl.cbegin(); iter != m_vStrTbl.cend(); ++iter, ++idx) {
-		WTXT_MsgPointer ptr;
+	size_t span_idx = 0;
+	for (size_t idx = 0; idx < str_count; idx++) {
+		const StrEntry entry = getEntry(idx);
+		WTXT_MsgPointer &ptr = vOffsetTbl[idx];
 		ptr.name_offset = INVALID_OFFSET;
 		ptr.text_offset = INVALID_OFFSET;
 		ptr.placeholder_offset = INVALID_OFFSET;
 
-		// Copy the message name.
-		if (!iter->first.empty()) {
+		// Message name.
+		if (entry.name_len != 0) {
 			// Is the name already present?
 			// This usually occurs if a string has the same name as the string table.
-			// TODO: Do we need to deduplicate *all* strings, or just the string table name.
-			auto map_iter = map_nameDedupe.find(iter->first);
-			if (map_iter != map_nameDedupe.end()) {
-				// Found the string.
-				ptr.name_offset = static_cast<uint32_t>(map_iter->second);
+			const char *const sjis_str = sjis_names.str(span_idx);
+			const size_t sjis_len = sjis_names.len(span_idx);
+			if (pool) {
+				key.assign(sjis_str, sjis_len);
 			} else {
-				// String not found, so cannot dedupe.
-				ptr.name_offset = static_cast<uint32_t>(vMsgNames.size());
-
-				// Convert to Shift-JIS first.
-				// TODO: Show warnings for strings with characters that
-				// can't be converted to Shift-JIS?
-				const string sjis_str = utf8_to_cpN(932, iter->first.data(), (int)iter->first.size());
-				// Copy the message name into the vector.
-				const size_t name_size = sjis_str.size();
-				// +1 for NULL terminator.
-				vMsgNames.resize(ptr.name_offset + name_size + 1);
-				memcpy(&vMsgNames[ptr.name_offset], sjis_str.c_str(), name_size+1);
-
-				// Add the string to the deduplication map.
-				map_nameDedupe.insert(std::make_pair(iter->first, ptr.name_offset));
+				key.assign(arenaStr(entry.name_off), entry.name_len);
 			}
+			ptr.name_offset = addDedupedName(sjis_str, sjis_len);
+			span_idx++;
 		} else {
 			// Empty message name...
 			// TODO: Report a warning.
-			ptr.name_offset = static_cast<uint32_t>(vMsgNames.size());
-
 			char buf[64];
 			int len = snprintf(buf, sizeof(buf), "XXX_MSG_%zu", idx);
-			// +1 for NULL terminator.
-			vMsgNames.resize(ptr.name_offset + len + 1);
-			memcpy(&vMsgNames[ptr.name_offset], buf, len+1);
+			dqGenNames.emplace_back(buf, len);
+			const string &gen_name = dqGenNames.back();
+			if (pool) {
+				key = gen_name;
+				ptr.name_offset = addDedupedName(gen_name.data(), gen_name.size());
+			} else {
+				ptr.name_offset = addName(gen_name.data(), gen_name.size());
+			}
 		}
-		assert(ptr.name_offset <= 16U*1024*1024);
 
-		// Copy the message text.
+		// Message text.
+		// NOTE: ptr.text_offset is in bytes.
 		// TODO: Add support for writing little-endian files?
-
-		// Copy the message text into the vector.
-		// NOTE: c16pos is in units of char16_t, whereas
-		// ptr.text_offset is in bytes.
-		const uint32_t c16pos = static_cast<uint32_t>(vMsgText.size());
-		ptr.text_offset = c16pos * sizeof(char16_t);
-		if (hostMatchesFileEndianness) {
-			// Host endianness matches file endianness.
-			// No conversion is necessary.
-			// TODO: Can we eliminate this copy?
-			msg_text = iter->second;
-		} else {
-			// Host byteorder does not match file endianness.
-			// Swap it.
-			if (!iter->second.empty()) {
-				msg_text = utf16_bswap(iter->second.data(), iter->second.size());
-			} else {
-				// Simply clear the message text.
-				msg_text.clear();
+		const TextSpan16 text = {arenaStr16(entry.text_off), entry.text_len};
+		ptr.text_offset = static_cast<uint32_t>(text_size);
+		bool isNewText = true;
+		if (pool) {
+			auto ins = map_textPool.insert(std::make_pair(
+				u16string(text.str, text.len), ptr.text_offset));
+			if (!ins.second) {
+				// Found the text.
+				ptr.text_offset = ins.first->second;
+				isNewText = false;
 			}
 		}
-
-		const size_t msg_size = msg_text.size();
-		vMsgText.resize(c16pos + msg_size + 1);
-		// +1 for NULL terminator.
-		memcpy(&vMsgText[c16pos], msg_text.c_str(), (msg_size+1) * sizeof(char16_t));
-
-		// NOTE: Text offset must be multiplied by sizeof(char16_t),
-		// since vMsgText is char16_t, but vOffsetTbl uses bytes.
-		assert(ptr.text_offset <= 16U*1024*1024);
+		if (isNewText) {
+			vTextSpans.push_back(text);
+			// +1 for NULL terminator.
+			text_size += (text.len + 1) * sizeof(char16_t);
+		}
 
 		// Do we have a placeholder name?
-		auto plc_iter = m_mapPlaceholder.find(idx);
-		if (plc_iter != m_mapPlaceholder.end()) {
+		if (entry.plc_off != INVALID_ARENA_OFFSET) {
 			// Is the name already present?
 			// This usually occurs if a string has the same name as the string table.
-			// TODO: Do we need to deduplicate *all* strings, or just the string table name.
-			auto map_iter = map_nameDedupe.find(plc_iter->second);
-			if (map_iter != map_nameDedupe.end()) {
-				// Found the string.
-				ptr.placeholder_offset = static_cast<uint32_t>(map_iter->second);
+			const char *const sjis_str = sjis_names.str(span_idx);
+			const size_t sjis_len = sjis_names.len(span_idx);
+			if (pool) {
+				key.assign(sjis_str, sjis_len);
 			} else {
-				// String not found, so cannot dedupe.
-				ptr.placeholder_offset = static_cast<uint32_t>(vMsgNames.size());
-
-				// Convert to Shift-JIS first.
-				// TODO: Show warnings for strings with characters that
-				// can't be converted to Shift-JIS?
-				const string sjis_str = utf8_to_cpN(932, plc_iter->second.data(), (int)plc_iter->second.size());
-				// Copy the message name into the vector.
-				const size_t name_size = sjis_str.size();
-				// +1 for NULL terminator.
-				vMsgNames.resize(ptr.placeholder_offset + name_size + 1);
-				memcpy(&vMsgNames[ptr.placeholder_offset], sjis_str.c_str(), name_size+1);
-
-				// Add the string to the deduplication map.
-				map_nameDedupe.insert(std::make_pair(plc_iter->second, ptr.placeholder_offset));
+				key.assign(arenaStr(entry.plc_off), entry.plc_len);
 			}
+			ptr.placeholder_offset = addDedupedName(sjis_str, sjis_len);
+			span_idx++;
 		}
 
-		// Add differential offset values.
-		assert(ptr.name_offset != INVALID_OFFSET);
-		assert(ptr.text_offset != INVALID_OFFSET);
-		if (ptr.name_offset != INVALID_OFFSET && ptr.text_offset != INVALID_OFFSET) {
-			if (ptr.placeholder_offset != INVALID_OFFSET) {
-				// Placeholder name is present.
-				vDiffOffTbl.push_back('A');
-				vDiffOffTbl.push_back('A');
-				vDiffOffTbl.push_back('A');
-			} else {
-				// Placeholder name is NOT present.
-				vDiffOffTbl.push_back('A');
-				vDiffOffTbl.push_back('B');
-			}
-		} else {
-			// ERROR: Name and text must be present...
-			// TODO: More comprehensive error reporting.
-			return -EIO;
+		// Pointer fields.
+		const uint64_t ptr_pos = sizeof(WTXT_Header) + ((uint64_t)idx * sizeof(WTXT_MsgPointer));
+		addPtrField(ptr_pos + offsetof(WTXT_MsgPointer, name_offset));
+		addPtrField(ptr_pos + offsetof(WTXT_MsgPointer, text_offset));
+		if (ptr.placeholder_offset != INVALID_OFFSET) {
+			addPtrField(ptr_pos + offsetof(WTXT_MsgPointer, placeholder_offset));
 		}
-
-		// Add the offsets to the offset table.
-		vOffsetTbl.push_back(ptr);
 	}
 
-	// Remove the last differential offset table entry,
-	// since it's EOF.
-	assert(!vDiffOffTbl.empty());
-	if (!vDiffOffTbl.empty()) {
-		vDiffOffTbl.resize(vDiffOffTbl.size()-1);
+	vector<TextSpan16> vTextSpansOrig;
+	vector<TextSpan> vNameSpansOrig;
+	vector<std::pair<uint32_t, uint32_t> > vTextRemap, vNameRemap;
+	if (suffix) {
+		// Merge strings that are suffixes of other strings,
+		// then update the offset table with the new offsets.
+		// NOTE: The string table name must remain at the start of the names table.
+		// The original strings are kept so the output can be checked.
+		vTextSpansOrig = vTextSpans;
+		vNameSpansOrig = vNameSpans;
+		text_size = mergeStringTails<char16_t>(vTextSpans, vTextRemap, 0);
+		names_size = mergeStringTails<char>(vNameSpans, vNameRemap, 1);
+
+		auto remap = [](const vector<std::pair<uint32_t, uint32_t> > &vRemap, uint32_t &offset) {
+			if (offset == INVALID_OFFSET)
+				return;
+			auto iter = std::lower_bound(vRemap.cbegin(), vRemap.cend(),
+				std::make_pair(offset, static_cast<uint32_t>(0)));
+			assert(iter != vRemap.cend() && iter->first == offset);
+			offset = iter->second;
+		};
+		for (auto iter = vOffsetTbl.begin(); iter != vOffsetTbl.end(); ++iter) {
+			remap(vNameRemap, iter->name_offset);
+			remap(vTextRemap, iter->text_offset);
+			remap(vNameRemap, iter->placeholder_offset);
+		}
 	}
 
-	// Determine the message table base addresses.
-	const uint32_t text_tbl_base = static_cast<uint32_t>(sizeof(wtxt_header) + (vOffsetTbl.size() * sizeof(WTXT_MsgPointer)));
-	const uint32_t name_tbl_base = static_cast<uint32_t>(text_tbl_base + (vMsgText.size() * sizeof(char16_t)));
-
-	// Differential offset table must be DWORD-aligned for both
+	// Determine the section offsets.
+	// NOTE: Offsets are relative to the end of the MST header.
+	// The differential offset table must be DWORD-aligned for both
 	// starting offset and length.
-	uint32_t doff_tbl_offset = static_cast<uint32_t>(name_tbl_base + vMsgNames.size());
-	if (doff_tbl_offset & 3) {
-		// Need to align the starting offset to a multiple of 4.
-		vMsgNames.resize(vMsgNames.size() + (4 - (doff_tbl_offset & 3)));
-		doff_tbl_offset = static_cast<uint32_t>(name_tbl_base + vMsgNames.size());
+	const uint64_t text_tbl_base = sizeof(WTXT_Header) + ((uint64_t)vOffsetTbl.size() * sizeof(WTXT_MsgPointer));
+	const uint64_t name_tbl_base = text_tbl_base + text_size;
+	const uint64_t doff_tbl_offset = (name_tbl_base + names_size + 3) & ~(uint64_t)3;
+	const uint64_t doff_tbl_length = ((uint64_t)vDiffOffTbl.size() + 3) & ~(uint64_t)3;
+
+	// Make sure the entire file fits within 32-bit offsets.
+	const uint64_t file_size = sizeof(MST_Header) + doff_tbl_offset + doff_tbl_length;
+	if (file_size > UINT32_MAX) {
+		// TODO: More comprehensive error reporting.
+		return -EFBIG;
 	}
-	uint32_t doff_tbl_length = static_cast<uint32_t>(vDiffOffTbl.size());
-	if (doff_tbl_length & 3) {
-		// Need to align the size to a multiple of 4.
-		vDiffOffTbl.resize((vDiffOffTbl.size() + 3) & ~(size_t)(3U));
-		doff_tbl_length = static_cast<uint32_t>(vDiffOffTbl.size());
+
+	/** Pass 2: Serialize the MST file. **/
+
+	unique_ptr<uint8_t[]> mst_data(new uint8_t[static_cast<size_t>(file_size)]);
+	uint8_t *const pOffTblU8 = &mst_data[sizeof(MST_Header)];
+
+	// Host endianness.
+	static const bool hostIsBigEndian = (SYS_BYTEORDER == SYS_BIG_ENDIAN);
+	const bool hostMatchesFileEndianness = (hostIsBigEndian == m_isBigEndian);
+
+	// MST header.
+	MST_Header mst_header;
+	memset(&mst_header, 0, sizeof(mst_header));
+	mst_header.version = m_version;
+	mst_header.endianness = (m_isBigEndian ? 'B' : 'L');
+	mst_header.bina_magic = cpu_to_be32(BINA_MAGIC);
+	mst_header.file_size = static_cast<uint32_t>(file_size);
+	mst_header.doff_tbl_offset = static_cast<uint32_t>(doff_tbl_offset);
+	mst_header.doff_tbl_length = static_cast<uint32_t>(doff_tbl_length);
+	if (!hostMatchesFileEndianness) {
+		// Endianness does not match. Byteswap!
+		mst_header.file_size = __swab32(mst_header.file_size);
+		mst_header.doff_tbl_offset = __swab32(mst_header.doff_tbl_offset);
+		mst_header.doff_tbl_length = __swab32(mst_header.doff_tbl_length);
 	}
+	memcpy(mst_data.get(), &mst_header, sizeof(mst_header));
 
-	// Update WTXT_Header.
-	wtxt_header.msg_tbl_name_offset = cpu_to_be32(name_tbl_base);
-	const uint32_t msg_tbl_count = static_cast<uint32_t>(vOffsetTbl.size());
-	wtxt_header.msg_tbl_count = cpu_to_be32(msg_tbl_count);
+	// WTXT header.
+	WTXT_Header wtxt_header;
+	wtxt_header.magic = cpu_to_be32(WTXT_MAGIC);
+	wtxt_header.msg_tbl_name_offset = static_cast<uint32_t>(name_tbl_base);
+	wtxt_header.msg_tbl_count = static_cast<uint32_t>(vOffsetTbl.size());
+	if (!hostMatchesFileEndianness) {
+		wtxt_header.msg_tbl_name_offset = __swab32(wtxt_header.msg_tbl_name_offset);
+		wtxt_header.msg_tbl_count = __swab32(wtxt_header.msg_tbl_count);
+	}
+	memcpy(pOffTblU8, &wtxt_header, sizeof(wtxt_header));
 
-	// Update the offset table base addresses.
+	// Offset table.
+	// Add the base addresses to the offsets.
 	for (auto iter = vOffsetTbl.begin(); iter != vOffsetTbl.end(); ++iter) {
 		if (iter->name_offset == INVALID_OFFSET) {
 			iter->name_offset = 0;
 		} else {
-			iter->name_offset += name_tbl_base;
+			iter->name_offset += static_cast<uint32_t>(name_tbl_base);
 		}
 
 		if (iter->text_offset == INVALID_OFFSET) {
 			iter->text_offset = 0;
 		} else {
-			iter->text_offset += text_tbl_base;
+			iter->text_offset += static_cast<uint32_t>(text_tbl_base);
 		}
 
 		if (iter->placeholder_offset == INVALID_OFFSET) {
 			iter->placeholder_offset = 0;
 		} else {
-			iter->placeholder_offset += name_tbl_base;
+			iter->placeholder_offset += static_cast<uint32_t>(name_tbl_base);
 		}
+	}
+	if (!hostMatchesFileEndianness) {
+		// Byteswap the offsets.
+		uint32_t *const pOffTbl32 = reinterpret_cast<uint32_t*>(vOffsetTbl.data());
+		__byte_swap_32_array(pOffTbl32, pOffTbl32,
+			vOffsetTbl.size() * (sizeof(WTXT_MsgPointer) / sizeof(uint32_t)));
+	}
+	memcpy(&pOffTblU8[sizeof(wtxt_header)], vOffsetTbl.data(), vOffsetTbl.size() * sizeof(WTXT_MsgPointer));
 
-		if (!hostMatchesFileEndianness) {
-			// Byteswap the offsets.
-			iter->name_offset		= __swab32(iter->name_offset);
-			iter->text_offset		= __swab32(iter->text_offset);
-			iter->placeholder_offset	= __swab32(iter->placeholder_offset);
+	// Message text.
+	// The text is written directly from the string arena.
+	uint8_t *pDest = &pOffTblU8[text_tbl_base];
+	for (auto iter = vTextSpans.cbegin(); iter != vTextSpans.cend(); ++iter) {
+		const size_t text_bytes = iter->len * sizeof(char16_t);
+		if (hostMatchesFileEndianness) {
+			// Host endianness matches file endianness.
+			// No conversion is necessary.
+			memcpy(pDest, iter->str, text_bytes);
+		} else {
+			// Host byteorder does not match file endianness.
+			// Swap it into the output buffer.
+			__byte_swap_16_array(reinterpret_cast<uint16_t*>(pDest),
+				reinterpret_cast<const uint16_t*>(iter->str), iter->len);
 		}
-	}
 
-	// Update the MST header.
-	if (hostMatchesFileEndianness) {
-		// Endianness matches. No conversion is necessary.
-		mst_header.file_size = sizeof(mst_header) + doff_tbl_offset + doff_tbl_length;
-		mst_header.doff_tbl_offset = doff_tbl_offset;
-		mst_header.doff_tbl_length = doff_tbl_length;
-	} else {
-		// Endianness does not match. Byteswap!
-		mst_header.file_size = __swab32(sizeof(mst_header) + doff_tbl_offset + doff_tbl_length);
-		mst_header.doff_tbl_offset = __swab32(doff_tbl_offset);
-		mst_header.doff_tbl_length = __swab32(doff_tbl_length);
+		// NULL terminator.
+		pDest[text_bytes] = 0;
+		pDest[text_bytes + 1] = 0;
+		pDest += text_bytes + sizeof(char16_t);
 	}
 
-	// Write everything to the file.
-	errno = 0;
-	size_t size = fwrite(&mst_header, 1, sizeof(mst_header), fp);
-	if (size != sizeof(mst_header)) {
-		return (errno ? -errno : -EIO);
-	}
-	errno = 0;
-	size = fwrite(&wtxt_header, 1, sizeof(wtxt_header), fp);
-	if (size != sizeof(wtxt_header)) {
-		return (errno ? -errno : -EIO);
-	}
-	errno = 0;
-	size = fwrite(vOffsetTbl.data(), sizeof(WTXT_MsgPointer), vOffsetTbl.size(), fp);
-	if (size != vOffsetTbl.size()) {
-		return (errno ? -errno : -EIO);
-	}
-	errno = 0;
-	size = fwrite(vMsgText.data(), sizeof(char16_t), vMsgText.size(), fp);
-	if (size != vMsgText.size()) {
-		return (errno ? -errno : -EIO);
+	// Names table.
+	assert(pDest == &pOffTblU8[name_tbl_base]);
+	for (auto iter = vNameSpans.cbegin(); iter != vNameSpans.cend(); ++iter) {
+		memcpy(pDest, iter->str, iter->len);
+		pDest[iter->len] = 0;
+		// +1 for NULL terminator.
+		pDest += iter->len + 1;
 	}
-	errno = 0;
-	size = fwrite(vMsgNames.data(), 1, vMsgNames.size(), fp);
-	if (size != vMsgNames.size()) {
-		return (errno ? -errno : -EIO);
+	// Alignment padding.
+	memset(pDest, 0, &pOffTblU8[doff_tbl_offset] - pDest);
+
+	// Differential offset table.
+	pDest = &pOffTblU8[doff_tbl_offset];
+	memcpy(pDest, vDiffOffTbl.data(), vDiffOffTbl.size());
+	pDest += vDiffOffTbl.size();
+	// Alignment padding.
+	memset(pDest, 0, &mst_data[file_size] - pDest);
+
+	if (suffix) {
+		// Make sure every merged string can be read back
+		// from its new offset before writing the file.
+		if (!checkStringTails<char16_t>(&pOffTblU8[text_tbl_base], text_size,
+			vTextSpansOrig, vTextRemap, !hostMatchesFileEndianness) ||
+		    !checkStringTails<char>(&pOffTblU8[name_tbl_base], names_size,
+			vNameSpansOrig, vNameRemap, false))
+		{
+			// TODO: More comprehensive error reporting.
+			return -EIO;
+		}
 	}
+
+	// Write everything to the file.
 	errno = 0;
-	size = fwrite(vDiffOffTbl.data(), 1, vDiffOffTbl.size(), fp);
-	if (size != vDiffOffTbl.size()) {
+	size_t size = fwrite(mst_data.get(), 1, static_cast<size_t>(file_size), fp);
+	if (size != file_size) {
 		return (errno ? -errno : -EIO);
 	}
 
@@ -868,7 +1973,7 @@ int Mst::saveXML(const TCHAR *filename) const
 {
 	if (!filename || !filename[0]) {
 		return -EINVAL;
-	} else if (m_vStrTbl.empty()) {
+	} else if ((strTblSize() == 0)) {
 		return -ENODATA;	// TODO: Better error code?
 	}
 
@@ -891,10 +1996,13 @@ int Mst::saveXML(const TCHAR *filename) const
 int Mst::saveXML(FILE *fp) const
 {
 	// BEFORE MST COMMIT: Check here!
-	if (m_vStrTbl.empty()) {
+	if ((strTblSize() == 0)) {
 		return -ENODATA;	// TODO: Better error code?
 	}
 
+	// Make sure all strings are decoded if lazy loading was used.
+	lazyDecodeAll();
+
 	// Create an XML document.
 	XMLDocument xml;
 	XMLDeclaration *const xml_decl = xml.NewDeclaration();
@@ -907,22 +2015,22 @@ int Mst::saveXML(FILE *fp) const
 	xml_mst06->SetAttribute("mst_version", verstr);
 	xml_mst06->SetAttribute("endianness", (m_isBigEndian ? "B" : "L"));
 
-	size_t idx = 0;
-	for (auto iter = m_vStrTbl.cbegin(); iter != m_vStrTbl.cend(); ++iter, ++idx) {
+	const size_t str_count = strTblSize();
+	for (size_t idx = 0; idx < str_count; idx++) {
+		const StrEntry entry = getEntry(idx);
 		XMLElement *const xml_msg = xml.NewElement("message");
 		xml_mst06->InsertEndChild(xml_msg);
 		xml_msg->SetAttribute("index", static_cast<unsigned int>(idx));
-		xml_msg->SetAttribute("name", iter->first.c_str());
+		xml_msg->SetAttribute("name", arenaStr(entry.name_off));
 
-		if (!iter->second.empty()) {
-			xml_msg->SetText(escape(utf16_to_utf8(iter->second)).c_str());
+		if (entry.text_len != 0) {
+			xml_msg->SetText(escape(utf16_to_utf8(arenaStr16(entry.text_off), entry.text_len)).c_str());
 		}
 
 		// Is there placeholder text?
-		auto plc_iter = m_mapPlaceholder.find(idx);
-		if (plc_iter != m_mapPlaceholder.end()) {
+		if (entry.plc_off != INVALID_ARENA_OFFSET) {
 			// Save the placeholder text as an attribute.
-			xml_msg->SetAttribute("placeholder", escape(plc_iter->second).c_str());
+			xml_msg->SetAttribute("placeholder", escape(string(arenaStr(entry.plc_off), entry.plc_len)).c_str());
 		}
 	}
 
@@ -938,18 +2046,21 @@ int Mst::saveXML(FILE *fp) const
  */
 void Mst::dump(void) const
 {
+	// Make sure all strings are decoded if lazy loading was used.
+	lazyDecodeAll();
+
 	printf("String table: %s\n", m_name.c_str());
-	size_t idx = 0;
-	for (auto iter = m_vStrTbl.cbegin(); iter != m_vStrTbl.cend(); ++iter, ++idx) {
-		printf("* Message %zu: %s -> ", idx, iter->first.c_str());
+	const size_t str_count = strTblSize();
+	for (size_t idx = 0; idx < str_count; idx++) {
+		const StrEntry entry = getEntry(idx);
+		printf("* Message %zu: %s -> ", idx, arenaStr(entry.name_off));
 
 		// Convert the message text from UTF-16 to UTF-8.
-		printf("%s\n", escape(utf16_to_utf8(iter->second)).c_str());
+		printf("%s\n", escape(utf16_to_utf8(arenaStr16(entry.text_off), entry.text_len)).c_str());
 
 		// Is there a placeholder name associated with this message?
-		auto plc_iter = m_mapPlaceholder.find(idx);
-		if (plc_iter != m_mapPlaceholder.end()) {
-			printf("*** Placeholder: %s\n", plc_iter->second.c_str());
+		if (entry.plc_off != INVALID_ARENA_OFFSET) {
+			printf("*** Placeholder: %s\n", arenaStr(entry.plc_off));
 		}
 	}
 }
@@ -963,9 +2074,12 @@ void Mst::dump(void) const
  */
 string Mst::strText_utf8(size_t index)
 {
-	if (index >= m_vStrTbl.size())
+	if (index >= strTblSize())
 		return string();
-	return utf16_to_utf8(m_vStrTbl[index].second);
+	if (m_lazyData)
+		lazyDecode(index, LAZY_TEXT);
+	const StrEntry entry = getEntry(index);
+	return utf16_to_utf8(arenaStr16(entry.text_off), entry.text_len);
 }
 
 /**
@@ -975,12 +2089,12 @@ string Mst::strText_utf8(size_t index)
  */
 string Mst::strText_utf8(const string &name)
 {
-	auto iter = m_vStrLkup.find(name);
-	if (iter == m_vStrLkup.end()) {
+	const size_t index = findStr(name);
+	if (index == ~(size_t)0) {
 		// Not found.
 		return string();
 	}
-	return strText_utf8(iter->second);
+	return strText_utf8(index);
 }
 
 /**
@@ -990,9 +2104,12 @@ string Mst::strText_utf8(const string &name)
  */
 u16string Mst::strText_utf16(size_t index)
 {
-	if (index >= m_vStrTbl.size())
+	if (index >= strTblSize())
 		return u16string();
-	return m_vStrTbl[index].second;
+	if (m_lazyData)
+		lazyDecode(index, LAZY_TEXT);
+	const StrEntry entry = getEntry(index);
+	return u16string(arenaStr16(entry.text_off), entry.text_len);
 }
 
 /**
@@ -1002,128 +2119,263 @@ u16string Mst::strText_utf16(size_t index)
  */
 u16string Mst::strText_utf16(const string &name)
 {
-	auto iter = m_vStrLkup.find(name);
-	if (iter == m_vStrLkup.end()) {
+	const size_t index = findStr(name);
+	if (index == ~(size_t)0) {
 		// Not found.
 		return u16string();
 	}
-	return strText_utf16(iter->second);
+	return strText_utf16(index);
 }
 
-/** String escape functions **/
+/** Lazy loading **/
 
 /**
- * Escape a UTF-8 string.
- * @param str Unescaped string.
- * @return Escaped string.
+ * Clear the lazy loading state.
+ * The raw MST data will be freed.
  */
-string Mst::escape(const string &str)
+void Mst::clearLazy(void) const
 {
-	bool isSpaceOnly = true;
+	m_lazyData.reset();
+	m_lazySize = 0;
+	m_vLazyState.clear();
+}
 
-	string ret;
-	ret.reserve(str.size() + 8);
-	for (auto iter = str.cbegin(); iter != str.cend(); ++iter) {
-		switch (*iter) {
-			case '\\':
-				ret += "\\\\";
-				isSpaceOnly = false;
-				break;
-			case '\n':
-				ret += "\\n";
-				isSpaceOnly = false;
-				break;
-			case '\f':
-				ret += "\\f";
-				isSpaceOnly = false;
-				break;
-			default:
-				ret += *iter;
-				if (*iter != ' ') {
-					isSpaceOnly = false;
-				}
-				break;
+/**
+ * Decode a string from the raw MST data if it hasn't been decoded yet.
+ * @param index String index.
+ * @param what LazyState bits to decode.
+ */
+void Mst::lazyDecode(size_t index, uint8_t what) const
+{
+	assert(m_lazyData != nullptr);
+	assert(index < m_vLazyState.size());
+	what &= ~m_vLazyState[index];
+	if (what == 0) {
+		// Already decoded.
+		return;
+	}
+
+	const uint8_t *const pOffTblU8 = &m_lazyData[sizeof(MST_Header)];
+	const uint8_t *const pOffTblEndU8 = &m_lazyData[m_lazySize];
+	const WTXT_MsgPointer *const pOffTbl = reinterpret_cast<const WTXT_MsgPointer*>(pOffTblU8 + sizeof(WTXT_Header));
+
+	// NOTE: The message pointers were converted to host-endian by parseMST().
+	const WTXT_MsgPointer &ptr = pOffTbl[index];
+
+	// NOTE: Out-of-range strings are left empty.
+	StrEntry entry = getEntry(index);
+	// TODO: Store more comprehensive error information.
+	if (what & LAZY_NAME) {
+		// Message name and placeholder name.
+		string name;
+		if (readSJIS(pOffTblU8, pOffTblEndU8, ptr.name_offset, name)) {
+			entry.name_off = arenaAdd(m_arena, name.data(), name.size());
+			entry.name_len = name.size();
+		}
+		if (ptr.placeholder_offset != 0) {
+			if (readSJIS(pOffTblU8, pOffTblEndU8, ptr.placeholder_offset, name)) {
+				entry.plc_off = arenaAdd(m_arena, name.data(), name.size());
+				entry.plc_len = name.size();
+			}
 		}
 	}
+	if (what & LAZY_TEXT) {
+		// Message text.
+		u16string text;
+		if (readUTF16(pOffTblU8, pOffTblEndU8, ptr.text_offset, m_isBigEndian, text)) {
+			entry.text_off = arenaAdd(m_arena, text.data(), text.size());
+			entry.text_len = text.size();
+		}
+	}
+
+	setEntry(index, entry);
+	m_vLazyState[index] |= what;
+}
+
+/**
+ * Decode all strings if lazy loading was used.
+ * The raw MST data will be freed afterwards.
+ */
+void Mst::lazyDecodeAll(void) const
+{
+	if (!m_lazyData) {
+		return;
+	}
 
-	// If the text is *only* spaces, change the first space to
-	// "\x20" to work around a bug in TinyXML2 where the text
-	// is assumed to be completely empty.
-	if (!ret.empty() && isSpaceOnly) {
-		ret = string("\\x20") + ret.substr(1);
+	const size_t count = strTblSize();
+	for (size_t idx = 0; idx < count; idx++) {
+		lazyDecode(idx, LAZY_NAME | LAZY_TEXT);
 	}
+	clearLazy();
+}
 
-	return ret;
+/** String escape functions **/
+
+/**
+ * Find the first occurrence of any of three characters.
+ * @tparam CharType Character type. (char or char16_t)
+ * @param str	[in] String.
+ * @param len	[in] Length of str, in characters.
+ * @param c1	[in] First character.
+ * @param c2	[in] Second character.
+ * @param c3	[in] Third character.
+ * @return Index of the first match, or len if not found.
+ */
+template<typename CharType>
+static inline size_t findFirstOf(const CharType *str, size_t len, CharType c1, CharType c2, CharType c3)
+{
+	size_t pos = 0;
+#ifdef HAVE_SSE2
+	static const size_t N = 16 / sizeof(CharType);
+	const __m128i v1 = (sizeof(CharType) == 1 ? _mm_set1_epi8(static_cast<char>(c1)) : _mm_set1_epi16(static_cast<short>(c1)));
+	const __m128i v2 = (sizeof(CharType) == 1 ? _mm_set1_epi8(static_cast<char>(c2)) : _mm_set1_epi16(static_cast<short>(c2)));
+	const __m128i v3 = (sizeof(CharType) == 1 ? _mm_set1_epi8(static_cast<char>(c3)) : _mm_set1_epi16(static_cast<short>(c3)));
+	for (; len - pos >= N; pos += N) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&str[pos]));
+		__m128i m;
+		if (sizeof(CharType) == 1) {
+			m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)), _mm_cmpeq_epi8(v, v3));
+		} else {
+			m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(v, v1), _mm_cmpeq_epi16(v, v2)), _mm_cmpeq_epi16(v, v3));
+		}
+		const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(m));
+		if (mask != 0) {
+			// Found a match.
+			unsigned int i = 0;
+			while (!(mask & (1U << i)))
+				i++;
+			return pos + (i / sizeof(CharType));
+		}
+	}
+#endif /* HAVE_SSE2 */
+	for (; pos < len; pos++) {
+		if (str[pos] == c1 || str[pos] == c2 || str[pos] == c3)
+			break;
+	}
+	return pos;
 }
 
 /**
- * Escape a UTF-16 string.
+ * Get the value of a hexadecimal digit.
+ * @tparam CharType Character type. (char or char16_t)
+ * @param chr Character.
+ * @return Value, or -1 if chr isn't a hexadecimal digit.
+ */
+template<typename CharType>
+static inline int hexDigitValue(CharType chr)
+{
+	if (chr >= '0' && chr <= '9') {
+		return chr - '0';
+	} else if (chr >= 'A' && chr <= 'F') {
+		return chr - 'A' + 10;
+	} else if (chr >= 'a' && chr <= 'f') {
+		return chr - 'a' + 10;
+	}
+	return -1;
+}
+
+/**
+ * Escape a string.
+ * @tparam CharType Character type. (char or char16_t)
  * @param str Unescaped string.
  * @return Escaped string.
  */
-u16string Mst::escape(const u16string &str)
+template<typename CharType>
+static std::basic_string<CharType> T_escape(const std::basic_string<CharType> &str)
 {
-	bool isSpaceOnly = true;
+	typedef std::basic_string<CharType> T_string;
+	const CharType *const p = str.data();
+	const size_t len = str.size();
+
+	size_t pos = findFirstOf<CharType>(p, len, '\\', '\n', '\f');
+	if (pos == len) {
+		// Nothing needs to be escaped.
+
+		// If the text is *only* spaces, change the first space to
+		// "\x20" to work around a bug in TinyXML2 where the text
+		// is assumed to be completely empty.
+		if (len == 0 || p[0] != ' ' || std::find_if(p, p + len,
+			[](CharType chr) { return chr != ' '; }) != p + len)
+		{
+			return str;
+		}
+
+		T_string ret;
+		ret.reserve(len + 3);
+		ret += '\\';
+		ret += 'x';
+		ret += '2';
+		ret += '0';
+		ret.append(p + 1, len - 1);
+		return ret;
+	}
 
-	u16string ret;
-	ret.reserve(str.size() + 8);
-	for (auto iter = str.cbegin(); iter != str.cend(); ++iter) {
-		switch (*iter) {
+	// Copy the text between escaped characters in bulk.
+	T_string ret;
+	ret.reserve(len + 8);
+	size_t start = 0;
+	while (pos < len) {
+		ret.append(p + start, pos - start);
+		ret += '\\';
+		switch (p[pos]) {
 			case '\\':
-				ret += u"\\\\";
-				isSpaceOnly = false;
+				ret += '\\';
 				break;
 			case '\n':
-				ret += u"\\n";
-				isSpaceOnly = false;
+				ret += 'n';
 				break;
 			case '\f':
-				ret += u"\\f";
-				isSpaceOnly = false;
+				ret += 'f';
 				break;
 			default:
-				ret += *iter;
-				if (*iter != u' ') {
-					isSpaceOnly = false;
-				}
+				assert(!"Unexpected character.");
 				break;
 		}
-	}
 
-	// If the text is *only* spaces, change the first space to
-	// "\x20" to work around a bug in TinyXML2 where the text
-	// is assumed to be completely empty.
-	if (!ret.empty() && isSpaceOnly) {
-		ret = u16string(u"\\x20") + ret.substr(1);
+		start = pos + 1;
+		pos = start + findFirstOf<CharType>(p + start, len - start, '\\', '\n', '\f');
 	}
-
+	ret.append(p + start, len - start);
 	return ret;
 }
 
 /**
- * Unescape a UTF-8 string.
+ * Unescape a string.
+ * NOTE: The string ends at the first NULL character, if any.
+ * @tparam CharType Character type. (char or char16_t)
  * @param str Escaped string.
  * @return Unescaped string.
  */
-string Mst::unescape(const string &str)
+template<typename CharType>
+static std::basic_string<CharType> T_unescape(const std::basic_string<CharType> &str)
 {
-	string ret;
-	ret.reserve(str.size());
-	for (const char *p = str.c_str(); *p != '\0'; p++) {
-		if (*p != '\\') {
-			// Not an escape character.
-			ret += *p;
-			continue;
-		}
+	typedef std::basic_string<CharType> T_string;
+	// NOTE: c_str() is used so the string is NULL-terminated.
+	const CharType *const p = str.c_str();
+	const size_t len = str.size();
+
+	size_t pos = findFirstOf<CharType>(p, len, '\\', '\0', '\0');
+	if (pos == len) {
+		// Nothing needs to be unescaped.
+		return str;
+	}
+
+	// Copy the text between escape sequences in bulk.
+	T_string ret;
+	ret.reserve(len);
+	size_t start = 0;
+	while (pos < len && p[pos] != '\0') {
+		ret.append(p + start, pos - start);
 
 		// Escape character.
-		p++;
-		if (*p == '\0') {
+		const CharType *q = &p[pos + 1];
+		if (*q == '\0') {
 			// Backslash at the end of the string.
 			ret += '\\';
+			start = pos = len;
 			break;
 		}
-		switch (*p) {
+		switch (*q) {
 			case '\\':
 				ret += '\\';
 				break;
@@ -1133,33 +2385,65 @@ string Mst::unescape(const string &str)
 			case 'f':
 				ret += '\f';
 				break;
-			case 'x':
+			case 'x': {
 				// Next two characters must be hexadecimal digits.
-				if (!isxdigit(p[1]) || !isxdigit(p[2])) {
+				const int hi = hexDigitValue(q[1]);
+				const int lo = (hi >= 0 ? hexDigitValue(q[2]) : -1);
+				if (lo < 0) {
 					// Invalid sequence.
 					// Skip over the "\\x" and continue.
 					// TODO: Return an error?
 				} else {
-					// Valid sequence. Convert to uint8_t.
-					char buf[3];
-					buf[0] = p[1];
-					buf[1] = p[2];
-					buf[2] = 0;
-					char chr = static_cast<char>(strtoul(buf, nullptr, 16));
-					ret += chr;
-					p += 2;
+					// Valid sequence.
+					ret += static_cast<CharType>((hi << 4) | lo);
+					q += 2;
 				}
 				break;
+			}
 			default:
 				// Invalid escape sequence.
 				ret += '\\';
-				ret += *p;
+				ret += *q;
 				break;
 		}
+
+		start = (q - p) + 1;
+		pos = start + findFirstOf<CharType>(p + start, len - start, '\\', '\0', '\0');
 	}
+	ret.append(p + start, pos - start);
 	return ret;
 }
 
+/**
+ * Escape a UTF-8 string.
+ * @param str Unescaped string.
+ * @return Escaped string.
+ */
+string Mst::escape(const string &str)
+{
+	return T_escape(str);
+}
+
+/**
+ * Escape a UTF-16 string.
+ * @param str Unescaped string.
+ * @return Escaped string.
+ */
+u16string Mst::escape(const u16string &str)
+{
+	return T_escape(str);
+}
+
+/**
+ * Unescape a UTF-8 string.
+ * @param str Escaped string.
+ * @return Unescaped string.
+ */
+string Mst::unescape(const string &str)
+{
+	return T_unescape(str);
+}
+
 /**
  * Unescape a UTF-16 string.
  * @param str Escaped string.
@@ -1167,57 +2451,5 @@ string Mst::unescape(const string &str)
  */
 u16string Mst::unescape(const u16string &str)
 {
-	u16string ret;
-	ret.reserve(str.size());
-	for (const char16_t *p = str.c_str(); *p != u'\0'; p++) {
-		if (*p != u'\\') {
-			// Not an escape character.
-			ret += *p;
-			continue;
-		}
-
-		// Escape character.
-		p++;
-		if (*p == u'\0') {
-			// Backslash at the end of the string.
-			ret += u'\\';
-			break;
-		}
-		switch (*p) {
-			case '\\':
-				ret += u'\\';
-				break;
-			case 'n':
-				ret += u'\n';
-				break;
-			case 'f':
-				ret += u'\f';
-				break;
-			case 'x':
-				// Next two characters must be hexadecimal digits.
-				if (p[1] >= 0x0100 || !isxdigit(p[1]) ||
-				    p[2] >= 0x0100 || !isxdigit(p[2]))
-				{
-					// Invalid sequence.
-					// Skip over the "\\x" and continue.
-					// TODO: Return an error?
-				} else {
-					// Valid sequence. Convert to uint8_t.
-					char buf[3];
-					buf[0] = static_cast<char>(p[1]);
-					buf[1] = static_cast<char>(p[2]);
-					buf[2] = static_cast<char>(0);
-					char16_t chr = static_cast<char16_t>(strtoul(buf, nullptr, 16));
-					ret += chr;
-					p += 2;
-				}
-				break;
-			default:
-				// Invalid escape sequence.
-				ret += u'\\';
-				ret += *p;
-				break;
-		}
-	}
-	return ret;
+	return T_unescape(str);
 }
@@ -15,10 +15,16 @@
 #include <cstdio>
 
 // C++ includes
+#include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "mst_structs.h"
+
+namespace tinyxml2 {
+	class XMLDocument;
+}
+
 class Mst
 {
 public:
@@ -35,23 +41,95 @@ public:
 	 * @param ppDiffOffTbl		[in/out] Pointer to current pointer into the differential offset table.
 	 * 				         This is adjusted based on the differential offset data.
 	 * @param pDiffOffTblEnd	[in] Pointer to the end of the differential offset table.
-	 * @return Offset value, or ~0U if end of table.
+	 * @return Offset value, relative to the previous offset, or ~0U if end of table.
 	 */
 	static uint32_t getNextDiffOff(const uint8_t **ppDiffOffTbl, const uint8_t *const pDiffOffTblEnd);
 
+	/**
+	 * Append an offset to a differential offset table.
+	 * The shortest encoding that can represent the offset is used.
+	 * @param vDiffOffTbl	[in/out] Differential offset table.
+	 * @param diff		[in] Offset, relative to the previous offset. Must be a non-zero multiple of 4.
+	 * @return 0 on success; negative POSIX error code on error.
+	 */
+	static int appendDiffOff(std::vector<uint8_t> &vDiffOffTbl, uint32_t diff);
+
+	/**
+	 * Verify an MST string table's differential offset table.
+	 * Every relocation is checked against the WTXT header and
+	 * WTXT_MsgPointer fields, and each pointer must point to a
+	 * NULL-terminated string in the text or names table.
+	 * NOTE: This only checks the file's structure. Strings are not
+	 * decoded, so a pointer to the wrong string is not detected.
+	 * @param data		[in] MST string table data.
+	 * @param size		[in] Size of data, in bytes.
+	 * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+	 * @return 0 if the table is valid; negative POSIX error code on error.
+	 */
+	static int verifyMST(const uint8_t *data, size_t size, std::vector<std::string> *pVecErrs = nullptr);
+
+	// Load flags.
+	enum LoadFlags {
+		// Lazy loading: Keep the raw MST data and only decode
+		// strings when they're first accessed.
+		// NOTE: Lazy decoding is not thread-safe, even for const accessors.
+		LOAD_FLAG_LAZY		= (1U << 0),
+
+		// Parallel loading: Decode messages using multiple threads.
+		// Only used for large tables. Ignored if LOAD_FLAG_LAZY is set.
+		LOAD_FLAG_PARALLEL	= (1U << 1),
+
+		// Large table mode: Allow files larger than 16 MB,
+		// up to the 4 GB limit of the format's 32-bit offsets.
+		// The string table uses 64-bit entries, since the decoded
+		// strings may be larger than 4 GB.
+		LOAD_FLAG_LARGE		= (1U << 2),
+	};
+
+	/**
+	 * Check an MST header and convert its fields to host-endian.
+	 * @param mst_header	[in/out] MST header.
+	 * @param flags		[in] Load flags. (See LoadFlags.)
+	 * @return 0 on success; negative POSIX error code on error.
+	 */
+	static int checkMstHeader(MST_Header &mst_header, unsigned int flags);
+
+	/**
+	 * Check the WTXT message count against an MST header.
+	 * The message pointer array must end before the differential offset table.
+	 * @param mst_header	[in] MST header. (host-endian; see checkMstHeader())
+	 * @param msg_tbl_count	[in] Message count. (host-endian)
+	 * @return 0 on success; negative POSIX error code on error.
+	 */
+	static int checkMsgTblCount(const MST_Header &mst_header, uint32_t msg_tbl_count);
+
 	/**
 	 * Load an MST string table.
 	 * @param filename MST string table filename.
+	 * @param flags Load flags. (See LoadFlags.)
 	 * @return 0 on success; negative POSIX error code on error.
 	 */
-	int loadMST(const TCHAR *filename);
+	int loadMST(const TCHAR *filename, unsigned int flags = 0);
 
 	/**
 	 * Load an MST string table.
 	 * @param fp MST string table file.
+	 * @param flags Load flags. (See LoadFlags.)
 	 * @return 0 on success; negative POSIX error code on error.
 	 */
-	int loadMST(FILE *fp);
+	int loadMST(FILE *fp, unsigned int flags = 0);
+
+	/**
+	 * Load an MST string table from memory.
+	 * The data is parsed in place. If LOAD_FLAG_LAZY is specified,
+	 * a copy of the data is kept, so the caller's buffer does not
+	 * need to remain valid after this function returns.
+	 * @param data MST string table data.
+	 * @param size Size of data, in bytes.
+	 * @param flags Load flags. (See LoadFlags.)
+	 * @return 0 on success; negative POSIX error code on error.
+	 */
+	int loadMST(const uint8_t *data, size_t size, unsigned int flags = 0);
 
 	/**
 	 * Load an XML string table.
@@ -69,19 +147,43 @@ public:
 	 */
 	int loadXML(FILE *fp, std::vector<std::string> *pVecErrs = nullptr);
 
+	/**
+	 * Load an XML string table from memory.
+	 * @param data		[in] XML data.
+	 * @param size		[in] Size of data, in bytes.
+	 * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+	 * @return 0 on success; negative POSIX error code or positive TinyXML2 error code on error.
+	 */
+	int loadXML(const uint8_t *data, size_t size, std::vector<std::string> *pVecErrs = nullptr);
+
+	// Save flags.
+	enum SaveFlags {
+		// String pooling: Store each distinct message text and
+		// each distinct Shift-JIS name only once. Messages with
+		// identical strings will point to the same copy.
+		SAVE_FLAG_POOL		= (1U << 0),
+
+		// Suffix sharing: If a string is a suffix of another string,
+		// point into the other string's tail instead of storing it
+		// separately. Implies SAVE_FLAG_POOL.
+		SAVE_FLAG_SUFFIX	= (1U << 1),
+	};
+
 	/**
 	 * Save the string table as MST.
 	 * @param filename MST filename.
+	 * @param flags Save flags. (See SaveFlags.)
 	 * @return 0 on success; negative POSIX error code on error.
 	 */
-	int saveMST(const TCHAR *filename) const;
+	int saveMST(const TCHAR *filename, unsigned int flags = 0) const;
 
 	/**
-	 * Save the string table as XML.
-	 * @param fp XML file.
+	 * Save the string table as MST.
+	 * @param fp MST file.
+	 * @param flags Save flags. (See SaveFlags.)
 	 * @return 0 on success; negative POSIX error code on error.
 	 */
-	int saveMST(FILE *fp) const;
+	int saveMST(FILE *fp, unsigned int flags = 0) const;
 
 	/**
 	 * Save the string table as XML.
@@ -134,7 +236,7 @@ public:
 	 */
 	size_t strCount(void) const
 	{
-		return m_vStrTbl.size();
+		return strTblSize();
 	}
 
 	/**
@@ -144,9 +246,12 @@ public:
 	 */
 	std::string strName(size_t index) const
 	{
-		if (index >= m_vStrTbl.size())
+		if (index >= strTblSize())
 			return std::string();
-		return m_vStrTbl[index].first;
+		if (m_lazyData)
+			lazyDecode(index, LAZY_NAME);
+		const StrEntry entry = getEntry(index);
+		return std::string(arenaStr(entry.name_off), entry.name_len);
 	}
 
 	/**
@@ -179,7 +284,6 @@ public:
 
 public:
 	/** String escape functions **/
-	// TODO: Use templates?
 
 	/**
 	 * Escape a UTF-8 string.
@@ -209,6 +313,200 @@ public:
 	 */
 	static std::u16string unescape(const std::u16string &str);
 
+private:
+	/** String storage **/
+
+	// String table entry.
+	// Strings are stored in m_arena, NULL-terminated.
+	// Offsets are in bytes; lengths are in characters,
+	// not including the NULL terminator.
+	template<typename T>
+	struct StrEntryT {
+		T name_off;	// String name (UTF-8)
+		T name_len;
+		T text_off;	// String text (UTF-16, host-endian)
+		T text_len;
+		T plc_off;	// Placeholder name (UTF-8), or ~0 if none
+		T plc_len;
+
+		StrEntryT()
+			: name_off(0), name_len(0)
+			, text_off(0), text_len(0)
+			, plc_off(~(T)0), plc_len(0)
+		{ }
+
+		/**
+		 * Convert an entry with a different field size.
+		 * NOTE: The caller must make sure the values fit.
+		 * @param other Entry.
+		 */
+		template<typename U>
+		explicit StrEntryT(const StrEntryT<U> &other)
+			: name_off(static_cast<T>(other.name_off))
+			, name_len(static_cast<T>(other.name_len))
+			, text_off(static_cast<T>(other.text_off))
+			, text_len(static_cast<T>(other.text_len))
+			, plc_off(other.plc_off == ~(U)0 ? ~(T)0 : static_cast<T>(other.plc_off))
+			, plc_len(static_cast<T>(other.plc_len))
+		{ }
+	};
+
+	// Stored entries use 32-bit fields, unless the arena may be
+	// larger than 4 GB. (See m_vStrTblLarge.)
+	typedef StrEntryT<uint32_t> StrEntry32;
+	// Full-size entry, used when getting and setting entries.
+	typedef StrEntryT<size_t> StrEntry;
+
+	/**
+	 * Get the number of string table entries.
+	 * @return Number of entries.
+	 */
+	size_t strTblSize(void) const
+	{
+		return (m_largeTbl ? m_vStrTblLarge.size() : m_vStrTbl.size());
+	}
+
+	/**
+	 * Get a string table entry.
+	 * @param index String index. (Must be in range.)
+	 * @return String table entry.
+	 */
+	StrEntry getEntry(size_t index) const
+	{
+		return (m_largeTbl ? m_vStrTblLarge[index] : StrEntry(m_vStrTbl[index]));
+	}
+
+	/**
+	 * Set a string table entry.
+	 * If the entry doesn't fit in 32 bits, the string table
+	 * is switched to 64-bit entries.
+	 * @param index	[in] String index. (Must be in range.)
+	 * @param entry	[in] String table entry.
+	 */
+	void setEntry(size_t index, const StrEntry &entry) const;
+
+	/**
+	 * Resize the string table.
+	 * New entries are empty.
+	 * @param count New number of entries.
+	 */
+	void resizeStrTbl(size_t count) const;
+
+	/**
+	 * Switch the string table to 64-bit entries.
+	 */
+	void useLargeStrTbl(void) const;
+
+	/**
+	 * Get a UTF-8 string from the arena.
+	 * @param off Arena offset.
+	 * @return UTF-8 string. (NULL-terminated)
+	 */
+	const char *arenaStr(size_t off) const
+	{
+		return reinterpret_cast<const char*>(&m_arena[off]);
+	}
+
+	/**
+	 * Get a UTF-16 string from the arena.
+	 * @param off Arena offset.
+	 * @return UTF-16 string. (NULL-terminated)
+	 */
+	const char16_t *arenaStr16(size_t off) const
+	{
+		return reinterpret_cast<const char16_t*>(&m_arena[off]);
+	}
+
+	/**
+	 * Append a UTF-8 string to an arena.
+	 * @param arena	[in/out] Arena.
+	 * @param str	[in] String.
+	 * @param len	[in] Length of str, in characters.
+	 * @return Arena offset of the string.
+	 */
+	static size_t arenaAdd(std::vector<uint8_t> &arena, const char *str, size_t len);
+
+	/**
+	 * Append a UTF-16 string to an arena.
+	 * The string will be aligned to a 2-byte boundary.
+	 * @param arena	[in/out] Arena.
+	 * @param str	[in] String.
+	 * @param len	[in] Length of str, in characters.
+	 * @return Arena offset of the string.
+	 */
+	static size_t arenaAdd(std::vector<uint8_t> &arena, const char16_t *str, size_t len);
+
+	/**
+	 * Find a string by name.
+	 * The name lookup table is rebuilt if necessary.
+	 * @param name String name. (UTF-8)
+	 * @return String index, or ~0 if not found.
+	 */
+	size_t findStr(const std::string &name) const;
+
+	/**
+	 * Clear the string table.
+	 */
+	void clear(void);
+
+	/**
+	 * Parse MST string table data.
+	 * @param mst_data	[in] MST data, including the MST header.
+	 * @param mst_header	[in] MST header. (host-endian; must have been checked)
+	 * @param flags		[in] Load flags. (See LoadFlags.)
+	 * @param pOwnedData	[in,opt] If mst_data is owned by the caller's unique_ptr, this points to it.
+	 *                	         For LOAD_FLAG_LAZY, it will be taken; otherwise, mst_data will be copied.
+	 * @return 0 on success; negative POSIX error code on error.
+	 */
+	int parseMST(const uint8_t *mst_data, const MST_Header &mst_header, unsigned int flags,
+		std::unique_ptr<uint8_t[]> *pOwnedData);
+
+	/**
+	 * Process a loaded XML document.
+	 * @param xml		[in] XML document.
+	 * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+	 * @return 0 on success; negative POSIX error code or positive TinyXML2 error code on error.
+	 */
+	int parseXML(tinyxml2::XMLDocument &xml, std::vector<std::string> *pVecErrs);
+
+	// Range of messages to decode. (Defined in Mst.cpp.)
+	struct MsgDecodeRange;
+
+	/**
+	 * Decode a range of messages.
+	 * Decoding stops at the first message that's out of range.
+	 * @param range Range of messages to decode.
+	 */
+	static void decodeMsgRange(MsgDecodeRange *range);
+
+private:
+	/** Lazy loading **/
+
+	// Lazy decoding state bits.
+	enum LazyState {
+		LAZY_NAME	= (1U << 0),	// Name and placeholder are decoded.
+		LAZY_TEXT	= (1U << 1),	// Text is decoded.
+	};
+
+	/**
+	 * Clear the lazy loading state.
+	 * The raw MST data will be freed.
+	 */
+	void clearLazy(void) const;
+
+	/**
+	 * Decode a string from the raw MST data if it hasn't been decoded yet.
+	 * @param index String index.
+	 * @param what LazyState bits to decode.
+	 */
+	void lazyDecode(size_t index, uint8_t what) const;
+
+	/**
+	 * Decode all strings if lazy loading was used.
+	 * The raw MST data will be freed afterwards.
+	 */
+	void lazyDecodeAll(void) const;
+
 private:
 	// MST information
 	char m_version;		// MST version number. ('1')
@@ -217,19 +515,33 @@ private:
 	// String table name (UTF-8)
 	std::string m_name;
 
+	// NOTE: The string tables are mutable because they're
+	// filled in on demand if lazy loading was used.
+
 	// Main string table
 	// - Index: String index
-	// - First: String name (UTF-8)
-	// - Second: String text (UTF-16)
-	std::vector<std::pair<std::string, std::u16string> > m_vStrTbl;
-
-	// Placeholder string table
-	// - Key: String index
-	// - Value: Placeholder string, if present (UTF-8)
-	std::unordered_map<size_t, std::string> m_mapPlaceholder;
+	// - Value: String entry, with offsets into m_arena
+	// Only one of these is used at a time. m_vStrTblLarge is used for
+	// LOAD_FLAG_LARGE, or if the arena grows larger than 4 GB.
+	mutable std::vector<StrEntry32> m_vStrTbl;
+	mutable std::vector<StrEntry> m_vStrTblLarge;
+	mutable bool m_largeTbl;	// True if m_vStrTblLarge is in use
+
+	// String arena
+	// All names, texts, and placeholders are stored here.
+	// Replaced strings are not removed until the table is cleared.
+	mutable std::vector<uint8_t> m_arena;
 
 	// String name to index lookup
-	// - Key: String name (UTF-8)
-	// - Value: String index
-	std::unordered_map<std::string, size_t> m_vStrLkup;
+	// - Value: String indexes, sorted by name
+	// Built on demand by findStr().
+	mutable std::vector<uint32_t> m_vStrLkup;
+	mutable bool m_lkupValid;	// True if m_vStrLkup is up to date
+
+	// Lazy loading
+	// If LOAD_FLAG_LAZY was specified, the raw MST data is kept
+	// until all strings are decoded.
+	mutable std::unique_ptr<uint8_t[]> m_lazyData;
+	mutable size_t m_lazySize;
+	mutable std::vector<uint8_t> m_vLazyState;	// LazyState bits for each string
 };
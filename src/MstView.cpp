@@ -0,0 +1,498 @@
+/***************************************************************************
+ * MST Decoder/Encoder for Sonic '06                                       *
+ * MstView.cpp: Read-only memory-mapped MST viewer.                        *
+ *                                                                         *
+ * Copyright (c) 2019-2025 by David Korth.                                 *
+ * SPDX-License-Identifier: MIT                                            *
+ ***************************************************************************/
+
+#include "config.mst06.h"
+#include "MstView.hpp"
+
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+# include <windows.h>
+#else /* !_WIN32 */
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif /* _WIN32 */
+
+// C++ includes.
+#include <algorithm>
+#include <string>
+#include <vector>
+using std::string;
+using std::u16string;
+using std::vector;
+
+#include "byteswap.h"
+#include "Mst.hpp"
+
+// Text encoding functions.
+#include "TextFuncs.hpp"
+
+#ifdef _WIN32
+/**
+ * Convert a Win32 error code to a POSIX error code.
+ * @param w32err Win32 error code.
+ * @return Positive POSIX error code. (EIO if no equivalent.)
+ */
+static int w32err_to_posix(DWORD w32err)
+{
+	switch (w32err) {
+		case ERROR_FILE_NOT_FOUND:
+		case ERROR_PATH_NOT_FOUND:
+		case ERROR_INVALID_DRIVE:
+			return ENOENT;
+		case ERROR_ACCESS_DENIED:
+		case ERROR_SHARING_VIOLATION:
+		case ERROR_LOCK_VIOLATION:
+			return EACCES;
+		case ERROR_TOO_MANY_OPEN_FILES:
+			return EMFILE;
+		case ERROR_NOT_ENOUGH_MEMORY:
+		case ERROR_OUTOFMEMORY:
+			return ENOMEM;
+		case ERROR_INVALID_NAME:
+		case ERROR_BAD_PATHNAME:
+			return EINVAL;
+		case ERROR_FILE_TOO_LARGE:
+			return EFBIG;
+		default:
+			return EIO;
+	}
+}
+#endif /* _WIN32 */
+
+MstView::MstView()
+	: m_pData(nullptr)
+	, m_size(0)
+	, m_mapSize(0)
+#ifdef _WIN32
+	, m_hFile(INVALID_HANDLE_VALUE)
+	, m_hMapping(nullptr)
+#endif /* _WIN32 */
+	, m_isBigEndian(true)
+	, m_count(0)
+	, m_lkupValid(false)
+{ }
+
+MstView::~MstView()
+{
+	close();
+}
+
+/**
+ * Open an MST string table.
+ * @param filename MST string table filename.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int MstView::open(const TCHAR *filename)
+{
+	if (!filename || !filename[0]) {
+		return -EINVAL;
+	}
+
+	close();
+
+	// Map the file.
+#ifdef _WIN32
+	HANDLE hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		// Error opening the file.
+		return -w32err_to_posix(GetLastError());
+	}
+	LARGE_INTEGER liFileSize;
+	if (!GetFileSizeEx(hFile, &liFileSize) || liFileSize.QuadPart < (LONGLONG)sizeof(MST_Header)) {
+		CloseHandle(hFile);
+		return -EIO;
+	}
+	HANDLE hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!hMapping) {
+		CloseHandle(hFile);
+		return -EIO;
+	}
+	const void *const pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!pData) {
+		CloseHandle(hMapping);
+		CloseHandle(hFile);
+		return -EIO;
+	}
+	m_hFile = hFile;
+	m_hMapping = hMapping;
+	m_mapSize = static_cast<size_t>(liFileSize.QuadPart);
+#else /* !_WIN32 */
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		// Error opening the file.
+		return -errno;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		int err = errno;
+		::close(fd);
+		return (err ? -err : -EIO);
+	} else if (sb.st_size < (off_t)sizeof(MST_Header)) {
+		// File is too small.
+		::close(fd);
+		return -EIO;
+	}
+	void *const pData = mmap(nullptr, static_cast<size_t>(sb.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	int err = errno;
+	// NOTE: The mapping remains valid after the file descriptor is closed.
+	::close(fd);
+	if (pData == MAP_FAILED) {
+		return (err ? -err : -EIO);
+	}
+	m_mapSize = static_cast<size_t>(sb.st_size);
+#endif /* _WIN32 */
+	m_pData = static_cast<const uint8_t*>(pData);
+	m_size = m_mapSize;
+
+	// Check the MST header.
+	// NOTE: Nothing is copied here, so large tables are allowed.
+	MST_Header mst_header;
+	memcpy(&mst_header, m_pData, sizeof(mst_header));
+	int ret = Mst::checkMstHeader(mst_header, Mst::LOAD_FLAG_LARGE);
+	if (ret != 0) {
+		close();
+		return ret;
+	} else if (mst_header.file_size > m_size) {
+		// Sanity check: File is truncated.
+		// TODO: Store more comprehensive error information.
+		close();
+		return -EIO;
+	}
+	m_isBigEndian = (mst_header.endianness == 'B');
+	// Ignore anything past the end of the MST data.
+	m_size = mst_header.file_size;
+
+	// Verify the WTXT header.
+	const WTXT_Header *const pWtxtHeader = reinterpret_cast<const WTXT_Header*>(&m_pData[sizeof(MST_Header)]);
+	const uint32_t count = fileToHost32(pWtxtHeader->msg_tbl_count);
+	ret = Mst::checkMsgTblCount(mst_header, count);
+	if (ret != 0) {
+		close();
+		return ret;
+	}
+	m_count = static_cast<size_t>(count);
+
+	return 0;
+}
+
+/**
+ * Close the MST string table.
+ */
+void MstView::close(void)
+{
+	if (!m_pData) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_pData);
+	CloseHandle(m_hMapping);
+	CloseHandle(m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else /* !_WIN32 */
+	munmap(const_cast<uint8_t*>(m_pData), m_mapSize);
+#endif /* _WIN32 */
+
+	m_pData = nullptr;
+	m_size = 0;
+	m_mapSize = 0;
+	m_isBigEndian = true;
+	m_count = 0;
+	m_vStrLkup.clear();
+	m_lkupValid = false;
+}
+
+/**
+ * Verify the differential offset table.
+ * Every relocation is checked against the WTXT header and
+ * WTXT_MsgPointer fields, and each pointer must point to a
+ * NULL-terminated string in the text or names table.
+ * NOTE: This only checks the file's structure. Strings are not
+ * decoded, so a pointer to the wrong string is not detected.
+ * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+ * @return 0 if the table is valid; negative POSIX error code on error.
+ */
+int MstView::verify(vector<string> *pVecErrs) const
+{
+	if (!m_pData) {
+		return -EBADF;
+	}
+	return Mst::verifyMST(m_pData, m_size, pVecErrs);
+}
+
+/**
+ * Read a 32-bit value in file endianness.
+ * @param val Value.
+ * @return Host-endian value.
+ */
+uint32_t MstView::fileToHost32(uint32_t val) const
+{
+	return (m_isBigEndian ? be32_to_cpu(val) : le32_to_cpu(val));
+}
+
+/**
+ * Get a Shift-JIS string from the mapped file.
+ * @param offset	[in] Offset, relative to the end of the MST header.
+ * @param pLen		[out] String length, in bytes.
+ * @return Pointer to the string, or nullptr if out of range.
+ */
+const char *MstView::getSJIS(uint32_t offset, size_t *pLen) const
+{
+	const size_t pos = sizeof(MST_Header) + static_cast<size_t>(offset);
+	if (pos >= m_size) {
+		// Out of range.
+		return nullptr;
+	}
+
+	const char *const str = reinterpret_cast<const char*>(&m_pData[pos]);
+	*pLen = strnlen(str, m_size - pos);
+	return str;
+}
+
+/**
+ * Get a UTF-16 string from the mapped file.
+ * @param offset	[in] Offset, relative to the end of the MST header.
+ * @param pLen		[out] String length, in characters.
+ * @return Pointer to the string (file endianness), or nullptr if out of range or misaligned.
+ */
+const char16_t *MstView::getUTF16(uint32_t offset, size_t *pLen) const
+{
+	const size_t pos = sizeof(MST_Header) + static_cast<size_t>(offset);
+	if (pos >= m_size) {
+		// Out of range.
+		return nullptr;
+	}
+
+	if (pos & 1) {
+		// Misaligned. UTF-16 text must start on a 2-byte boundary.
+		// NOTE: The mapping is page-aligned, so only pos needs to be checked.
+		return nullptr;
+	}
+
+	// NOTE: NULL is 0 in both endiannesses, so no byteswapping is needed here.
+	const char16_t *const wcs = reinterpret_cast<const char16_t*>(&m_pData[pos]);
+	const size_t len = utf16_nlen(wcs, (m_size - pos) / sizeof(char16_t));
+	*pLen = len;
+	return wcs;
+}
+
+/**
+ * Get a message pointer, byteswapped to host-endian.
+ * @param index	[in] String index.
+ * @param ptr	[out] Message pointer.
+ * @return True on success; false if index is out of range.
+ */
+bool MstView::getMsgPointer(size_t index, WTXT_MsgPointer &ptr) const
+{
+	if (index >= m_count) {
+		return false;
+	}
+
+	const WTXT_MsgPointer *const pOffTbl = reinterpret_cast<const WTXT_MsgPointer*>(
+		&m_pData[sizeof(MST_Header) + sizeof(WTXT_Header)]);
+	const WTXT_MsgPointer *const p = &pOffTbl[index];
+	ptr.name_offset		= fileToHost32(p->name_offset);
+	ptr.text_offset		= fileToHost32(p->text_offset);
+	ptr.placeholder_offset	= fileToHost32(p->placeholder_offset);
+	return true;
+}
+
+/** Accessors **/
+
+/**
+ * Get the string table name.
+ * @return String table name. (UTF-8)
+ */
+string MstView::tblName(void) const
+{
+	if (!m_pData) {
+		return string();
+	}
+
+	const WTXT_Header *const pWtxtHeader = reinterpret_cast<const WTXT_Header*>(&m_pData[sizeof(MST_Header)]);
+	size_t len;
+	const char *const str = getSJIS(fileToHost32(pWtxtHeader->msg_tbl_name_offset), &len);
+	if (!str) {
+		// String table name is out of range.
+		return string();
+	}
+	return cpN_to_utf8(932, str, len);
+}
+
+/**
+ * Find a string by name.
+ * The name is compared against the mapped Shift-JIS names
+ * without decoding them. A sorted name index is built on
+ * the first lookup.
+ * @param name String name. (UTF-8)
+ * @return String index, or ~0 if not found.
+ */
+size_t MstView::findStr(const string &name) const
+{
+	if (!m_pData || name.empty()) {
+		return ~(size_t)0;
+	}
+
+	// Convert the name to Shift-JIS once, then compare raw bytes.
+	const string sjis_name = utf8_to_cpN(932, name.data(), name.size());
+	if (sjis_name.empty()) {
+		return ~(size_t)0;
+	}
+
+	// Get a mapped name by string index.
+	// Out-of-range names are treated as empty strings.
+	auto getName = [this](uint32_t idx, size_t *pLen) -> const char* {
+		WTXT_MsgPointer ptr;
+		const char *const str = (getMsgPointer(idx, ptr)
+			? getSJIS(ptr.name_offset, pLen)
+			: nullptr);
+		if (!str) {
+			*pLen = 0;
+			return "";
+		}
+		return str;
+	};
+
+	if (!m_lkupValid) {
+		// Build the lookup table.
+		m_vStrLkup.resize(m_count);
+		for (size_t idx = 0; idx < m_count; idx++) {
+			m_vStrLkup[idx] = static_cast<uint32_t>(idx);
+		}
+
+		// Stable sort, so the first string with a given name is found
+		// if there are duplicates.
+		std::stable_sort(m_vStrLkup.begin(), m_vStrLkup.end(),
+			[&getName](uint32_t a, uint32_t b) {
+				size_t len_a, len_b;
+				const char *const str_a = getName(a, &len_a);
+				const char *const str_b = getName(b, &len_b);
+				const int cmp = memcmp(str_a, str_b, std::min(len_a, len_b));
+				return (cmp < 0 || (cmp == 0 && len_a < len_b));
+			});
+		m_lkupValid = true;
+	}
+
+	auto iter = std::lower_bound(m_vStrLkup.cbegin(), m_vStrLkup.cend(), sjis_name,
+		[&getName](uint32_t a, const string &b) {
+			size_t len_a;
+			const char *const str_a = getName(a, &len_a);
+			const int cmp = memcmp(str_a, b.data(), std::min(len_a, b.size()));
+			return (cmp < 0 || (cmp == 0 && len_a < b.size()));
+		});
+	if (iter == m_vStrLkup.cend()) {
+		// Not found.
+		return ~(size_t)0;
+	}
+
+	size_t len;
+	const char *const str = getName(*iter, &len);
+	if (len != sjis_name.size() || memcmp(str, sjis_name.data(), len) != 0) {
+		// Not found.
+		return ~(size_t)0;
+	}
+	return *iter;
+}
+
+/**
+ * Get a string's name. (UTF-8)
+ * @param index String index.
+ * @return String name. (UTF-8)
+ */
+string MstView::strName(size_t index) const
+{
+	WTXT_MsgPointer ptr;
+	if (!getMsgPointer(index, ptr)) {
+		return string();
+	}
+
+	size_t len;
+	const char *const str = getSJIS(ptr.name_offset, &len);
+	if (!str) {
+		// MsgName is out of range.
+		return string();
+	}
+	return cpN_to_utf8(932, str, len);
+}
+
+/**
+ * Get a string's text. (UTF-8)
+ * @param index String index.
+ * @return String text. (UTF-8)
+ */
+string MstView::strText_utf8(size_t index) const
+{
+	WTXT_MsgPointer ptr;
+	if (!getMsgPointer(index, ptr)) {
+		return string();
+	}
+
+	size_t len;
+	const char16_t *const wcs = getUTF16(ptr.text_offset, &len);
+	if (!wcs) {
+		// MsgText is out of range.
+		return string();
+	}
+
+	// Convert directly from the mapped file.
+	return (m_isBigEndian
+		? utf16be_to_utf8(wcs, len)
+		: utf16le_to_utf8(wcs, len));
+}
+
+/**
+ * Get a string's text. (UTF-16)
+ * @param index String index.
+ * @return String text. (UTF-16)
+ */
+u16string MstView::strText_utf16(size_t index) const
+{
+	WTXT_MsgPointer ptr;
+	if (!getMsgPointer(index, ptr)) {
+		return u16string();
+	}
+
+	size_t len;
+	const char16_t *const wcs = getUTF16(ptr.text_offset, &len);
+	if (!wcs || len == 0) {
+		// MsgText is out of range or empty.
+		return u16string();
+	}
+
+	return (m_isBigEndian
+		? utf16be_to_utf16(wcs, len)
+		: utf16le_to_utf16(wcs, len));
+}
+
+/**
+ * Get a string's placeholder name. (UTF-8)
+ * @param index String index.
+ * @return Placeholder name (UTF-8), or empty string if none.
+ */
+string MstView::strPlaceholder(size_t index) const
+{
+	WTXT_MsgPointer ptr;
+	if (!getMsgPointer(index, ptr) || ptr.placeholder_offset == 0) {
+		return string();
+	}
+
+	size_t len;
+	const char *const str = getSJIS(ptr.placeholder_offset, &len);
+	if (!str) {
+		// PlaceholderName is out of range.
+		return string();
+	}
+	return cpN_to_utf8(932, str, len);
+}
@@ -0,0 +1,192 @@
+/***************************************************************************
+ * MST Decoder/Encoder for Sonic '06                                       *
+ * MstView.hpp: Read-only memory-mapped MST viewer.                        *
+ *                                                                         *
+ * Copyright (c) 2019-2025 by David Korth.                                 *
+ * SPDX-License-Identifier: MIT                                            *
+ ***************************************************************************/
+
+#pragma once
+
+#include "tcharx.h"
+
+// C includes (C++ namespace)
+#include <cstddef>
+#include <cstdint>
+
+// C++ includes
+#include <string>
+#include <vector>
+
+#include "mst_structs.h"
+
+/**
+ * Read-only MST string table viewer.
+ *
+ * Unlike Mst, MstView does not copy the string table into
+ * containers when it's opened. The file is memory-mapped, and
+ * names, text, and placeholders are decoded directly from the
+ * mapped WTXT_MsgPointer array when they're requested.
+ */
+class MstView
+{
+public:
+	MstView();
+	~MstView();
+
+public:
+	// Disable copying.
+	MstView(const MstView&) = delete;
+	MstView &operator=(const MstView&) = delete;
+
+public:
+	/**
+	 * Open an MST string table.
+	 * @param filename MST string table filename.
+	 * @return 0 on success; negative POSIX error code on error.
+	 */
+	int open(const TCHAR *filename);
+
+	/**
+	 * Close the MST string table.
+	 */
+	void close(void);
+
+	/**
+	 * Is an MST string table open?
+	 * @return True if open; false if not.
+	 */
+	bool isOpen(void) const
+	{
+		return (m_pData != nullptr);
+	}
+
+	/**
+	 * Verify the differential offset table.
+	 * Every relocation is checked against the WTXT header and
+	 * WTXT_MsgPointer fields, and each pointer must point to a
+	 * NULL-terminated string in the text or names table.
+	 * NOTE: This only checks the file's structure. Strings are not
+	 * decoded, so a pointer to the wrong string is not detected.
+	 * @param pVecErrs	[out,opt] Vector of user-readable error messages.
+	 * @return 0 if the table is valid; negative POSIX error code on error.
+	 */
+	int verify(std::vector<std::string> *pVecErrs = nullptr) const;
+
+public:
+	/** Accessors **/
+
+	/**
+	 * Is the file big-endian?
+	 * @return True if the file is big-endian; false if not.
+	 */
+	bool isBigEndian(void) const
+	{
+		return m_isBigEndian;
+	}
+
+	/**
+	 * Get the string table name.
+	 * @return String table name. (UTF-8)
+	 */
+	std::string tblName(void) const;
+
+	/**
+	 * Get the string count.
+	 * @return Number of strings.
+	 */
+	size_t strCount(void) const
+	{
+		return m_count;
+	}
+
+	/**
+	 * Find a string by name.
+	 * The name is compared against the mapped Shift-JIS names
+	 * without decoding them. A sorted name index is built on
+	 * the first lookup.
+	 * @param name String name. (UTF-8)
+	 * @return String index, or ~0 if not found.
+	 */
+	size_t findStr(const std::string &name) const;
+
+	/**
+	 * Get a string's name. (UTF-8)
+	 * @param index String index.
+	 * @return String name. (UTF-8)
+	 */
+	std::string strName(size_t index) const;
+
+	/**
+	 * Get a string's text. (UTF-8)
+	 * @param index String index.
+	 * @return String text. (UTF-8)
+	 */
+	std::string strText_utf8(size_t index) const;
+
+	/**
+	 * Get a string's text. (UTF-16)
+	 * @param index String index.
+	 * @return String text. (UTF-16)
+	 */
+	std::u16string strText_utf16(size_t index) const;
+
+	/**
+	 * Get a string's placeholder name. (UTF-8)
+	 * @param index String index.
+	 * @return Placeholder name (UTF-8), or empty string if none.
+	 */
+	std::string strPlaceholder(size_t index) const;
+
+private:
+	/**
+	 * Get a Shift-JIS string from the mapped file.
+	 * @param offset	[in] Offset, relative to the end of the MST header.
+	 * @param pLen		[out] String length, in bytes.
+	 * @return Pointer to the string, or nullptr if out of range.
+	 */
+	const char *getSJIS(uint32_t offset, size_t *pLen) const;
+
+	/**
+	 * Get a UTF-16 string from the mapped file.
+	 * @param offset	[in] Offset, relative to the end of the MST header.
+	 * @param pLen		[out] String length, in characters.
+	 * @return Pointer to the string (file endianness), or nullptr if out of range.
+	 */
+	const char16_t *getUTF16(uint32_t offset, size_t *pLen) const;
+
+	/**
+	 * Get a message pointer, byteswapped to host-endian.
+	 * @param index	[in] String index.
+	 * @param ptr	[out] Message pointer.
+	 * @return True on success; false if index is out of range.
+	 */
+	bool getMsgPointer(size_t index, WTXT_MsgPointer &ptr) const;
+
+	/**
+	 * Read a 32-bit value in file endianness.
+	 * @param val Value.
+	 * @return Host-endian value.
+	 */
+	uint32_t fileToHost32(uint32_t val) const;
+
+private:
+	// Mapped file
+	const uint8_t *m_pData;
+	size_t m_size;		// Size of the MST data.
+	size_t m_mapSize;	// Size of the mapping.
+#ifdef _WIN32
+	void *m_hFile;		// HANDLE
+	void *m_hMapping;	// HANDLE
+#endif /* _WIN32 */
+
+	// MST information
+	bool m_isBigEndian;	// True if this file is big-endian.
+	size_t m_count;		// Number of strings.
+
+	// String name to index lookup
+	// - Value: String indexes, sorted by Shift-JIS name
+	// Built on demand by findStr().
+	mutable std::vector<uint32_t> m_vStrLkup;
+	mutable bool m_lkupValid;	// True if m_vStrLkup has been built
+};
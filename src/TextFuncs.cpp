@@ -8,9 +8,14 @@
 
 #include "TextFuncs.hpp"
 #include "byteswap.h"
+#include "common.h"
+
+// C includes (C++ namespace)
+#include <cstring>
 
 // C++ includes.
 #include <string>
+using std::string;
 using std::u16string;
 
 /**
@@ -25,12 +30,457 @@ u16string utf16_bswap(const char16_t *str, size_t len)
 		return u16string();
 	}
 
-	// TODO: Optimize this?
 	u16string ret;
-	ret.reserve(len);
-	for (; len > 0; len--, str++) {
-		ret += __swab16(*str);
+	ret.resize(len);
+	__byte_swap_16_array(reinterpret_cast<uint16_t*>(&ret[0]),
+		reinterpret_cast<const uint16_t*>(str), len);
+	return ret;
+}
+
+/**
+ * Get the length of NULL-terminated UTF-16 text.
+ * @param wcs	[in] UTF-16 text.
+ * @param maxLen	[in] Maximum length of wcs, in characters.
+ * @return Length of wcs, in characters. (maxLen if no NULL terminator was found)
+ */
+size_t utf16_nlen(const char16_t *wcs, size_t maxLen)
+{
+	size_t pos = 0;
+#ifdef HAVE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; maxLen - pos >= 8; pos += 8) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&wcs[pos]));
+		const unsigned int mask = static_cast<unsigned int>(
+			_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)));
+		if (mask != 0) {
+			// Found the NULL terminator.
+			// Each character has two mask bits.
+			unsigned int i = 0;
+			while (!(mask & (1U << i)))
+				i += 2;
+			return pos + (i / 2);
+		}
+	}
+#endif /* HAVE_SSE2 */
+	for (; pos < maxLen; pos++) {
+		if (wcs[pos] == 0)
+			break;
+	}
+	return pos;
+}
+
+/**
+ * Copy NULL-terminated UTF-16 text, optionally byteswapping it.
+ * The NULL terminator is located first, so the output string
+ * is allocated once at its final size.
+ * @param wcs	[in] UTF-16 text.
+ * @param maxLen	[in] Maximum length of wcs, in characters.
+ * @param bswap	[in] If true, byteswap the text.
+ * @return UTF-16 string, up to but not including the NULL terminator.
+ */
+u16string utf16_scan_copy(const char16_t *wcs, size_t maxLen, bool bswap)
+{
+	u16string ret;
+	const size_t len = (maxLen != 0 ? utf16_nlen(wcs, maxLen) : 0);
+	if (len == 0) {
+		return ret;
+	}
+
+	ret.resize(len);
+	if (bswap) {
+		__byte_swap_16_array(reinterpret_cast<uint16_t*>(&ret[0]),
+			reinterpret_cast<const uint16_t*>(wcs), len);
+	} else {
+		memcpy(&ret[0], wcs, len * sizeof(char16_t));
+	}
+	return ret;
+}
+
+/** UTF-8 to UTF-16 and vice-versa **/
+
+// Unicode replacement character, used for invalid sequences.
+#define UNICODE_REPLACEMENT_CHAR 0xFFFD
+
+/**
+ * Convert UTF-16 text to UTF-8, appending it to a string.
+ * Unpaired surrogates are converted to U+FFFD.
+ * @tparam bswap If true, byteswap the text.
+ * @param ret	[in/out] Output string.
+ * @param wcs	[in] UTF-16 text.
+ * @param len	[in] Length of wcs, in characters.
+ */
+template<bool bswap>
+static FORCEINLINE void T_utf16_to_utf8(string &ret, const char16_t *wcs, size_t len)
+{
+	// Worst case: 3 bytes per UTF-16 character.
+	// (Surrogate pairs are 4 bytes for 2 UTF-16 characters.)
+	const size_t start = ret.size();
+	ret.resize(start + (len * 3));
+	char *const out_start = &ret[0];
+	char *out = out_start + start;
+
+	size_t pos = 0;
+	while (pos < len) {
+#ifdef HAVE_SSE2
+		// ASCII fast path: Convert 8 characters at a time.
+		if (len - pos >= 8) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&wcs[pos]));
+			if (bswap) {
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			}
+			const __m128i hi = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xFF80)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_setzero_si128())) == 0xFFFF) {
+				// All ASCII.
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(v, v));
+				out += 8;
+				pos += 8;
+				continue;
+			}
+		}
+		// Not all ASCII. Convert this block using the scalar loop.
+		const size_t block_end = (len - pos >= 8 ? pos + 8 : len);
+#else /* !HAVE_SSE2 */
+		const size_t block_end = len;
+#endif /* HAVE_SSE2 */
+
+		for (; pos < block_end; pos++) {
+			unsigned int chr = (bswap ? __swab16(wcs[pos]) : wcs[pos]);
+			if (chr < 0x80) {
+				*out++ = static_cast<char>(chr);
+				continue;
+			} else if (chr < 0x800) {
+				*out++ = static_cast<char>(0xC0 | (chr >> 6));
+				*out++ = static_cast<char>(0x80 | (chr & 0x3F));
+				continue;
+			} else if (chr >= 0xD800 && chr <= 0xDFFF) {
+				// Surrogate. Check for a valid surrogate pair.
+				const unsigned int chr2 = (pos + 1 < len
+					? (bswap ? __swab16(wcs[pos+1]) : wcs[pos+1])
+					: 0);
+				if (chr <= 0xDBFF && chr2 >= 0xDC00 && chr2 <= 0xDFFF) {
+					const unsigned int cp = 0x10000 + ((chr & 0x3FF) << 10) + (chr2 & 0x3FF);
+					*out++ = static_cast<char>(0xF0 | (cp >> 18));
+					*out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+					*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+					*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+					pos++;
+					continue;
+				}
+
+				// Unpaired surrogate.
+				chr = UNICODE_REPLACEMENT_CHAR;
+			}
+
+			*out++ = static_cast<char>(0xE0 | (chr >> 12));
+			*out++ = static_cast<char>(0x80 | ((chr >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (chr & 0x3F));
+		}
+	}
+
+	ret.resize(out - out_start);
+}
+
+/**
+ * Convert UTF-16LE text to UTF-8.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param wcs	[in] UTF-16LE text.
+ * @param len	[in] Length of wcs, in characters.
+ * @return UTF-8 string.
+ */
+string utf16le_to_utf8(const char16_t *wcs, size_t len)
+{
+	string ret;
+	if (!wcs || len == 0) {
+		// Empty string.
+		return ret;
+	}
+
+#if SYS_BYTEORDER == SYS_LIL_ENDIAN
+	T_utf16_to_utf8<false>(ret, wcs, len);
+#else /* SYS_BYTEORDER == SYS_BIG_ENDIAN */
+	T_utf16_to_utf8<true>(ret, wcs, len);
+#endif
+	return ret;
+}
+
+/**
+ * Convert UTF-16BE text to UTF-8.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param wcs	[in] UTF-16BE text.
+ * @param len	[in] Length of wcs, in characters.
+ * @return UTF-8 string.
+ */
+string utf16be_to_utf8(const char16_t *wcs, size_t len)
+{
+	string ret;
+	if (!wcs || len == 0) {
+		// Empty string.
+		return ret;
+	}
+
+#if SYS_BYTEORDER == SYS_LIL_ENDIAN
+	T_utf16_to_utf8<true>(ret, wcs, len);
+#else /* SYS_BYTEORDER == SYS_BIG_ENDIAN */
+	T_utf16_to_utf8<false>(ret, wcs, len);
+#endif
+	return ret;
+}
+
+/**
+ * Convert UTF-8 text to UTF-16.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * Invalid sequences are converted to U+FFFD.
+ * @param str	[in] UTF-8 text.
+ * @param len	[in] Length of str, in bytes.
+ * @return UTF-16 string. (host-endian)
+ */
+u16string utf8_to_utf16(const char *str, size_t len)
+{
+	u16string ret;
+	if (!str || len == 0) {
+		// Empty string.
+		return ret;
 	}
 
+	// Worst case: 1 UTF-16 character per byte.
+	ret.resize(len);
+	char16_t *const out_start = &ret[0];
+	char16_t *out = out_start;
+
+	const uint8_t *const p_start = reinterpret_cast<const uint8_t*>(str);
+	const uint8_t *p = p_start;
+	const uint8_t *const p_end = p_start + len;
+	while (p < p_end) {
+#ifdef HAVE_SSE2
+		// ASCII fast path: Convert 16 bytes at a time.
+		if (p_end - p >= 16) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			if (_mm_movemask_epi8(v) == 0) {
+				// All ASCII.
+				const __m128i zero = _mm_setzero_si128();
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(v, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(v, zero));
+				out += 16;
+				p += 16;
+				continue;
+			}
+		}
+		// Not all ASCII. Convert this block using the scalar loop.
+		const uint8_t *const block_end = (p_end - p >= 16 ? p + 16 : p_end);
+#else /* !HAVE_SSE2 */
+		const uint8_t *const block_end = p_end;
+#endif /* HAVE_SSE2 */
+
+		while (p < block_end) {
+			const uint8_t c = *p;
+			if (c < 0x80) {
+				*out++ = c;
+				p++;
+				continue;
+			}
+
+			// Determine the sequence length and the valid range
+			// for the second byte, which rejects overlong sequences,
+			// surrogates, and code points over U+10FFFF.
+			unsigned int seq_len, cp;
+			uint8_t min2 = 0x80, max2 = 0xBF;
+			if (c >= 0xC2 && c <= 0xDF) {
+				seq_len = 2;
+				cp = c & 0x1F;
+			} else if (c >= 0xE0 && c <= 0xEF) {
+				seq_len = 3;
+				cp = c & 0x0F;
+				if (c == 0xE0) {
+					min2 = 0xA0;
+				} else if (c == 0xED) {
+					max2 = 0x9F;
+				}
+			} else if (c >= 0xF0 && c <= 0xF4) {
+				seq_len = 4;
+				cp = c & 0x07;
+				if (c == 0xF0) {
+					min2 = 0x90;
+				} else if (c == 0xF4) {
+					max2 = 0x8F;
+				}
+			} else {
+				// Invalid lead byte.
+				*out++ = UNICODE_REPLACEMENT_CHAR;
+				p++;
+				continue;
+			}
+
+			// Check the continuation bytes.
+			unsigned int i;
+			for (i = 1; i < seq_len && p + i < p_end; i++) {
+				const uint8_t cc = p[i];
+				if (i == 1 ? (cc < min2 || cc > max2) : ((cc & 0xC0) != 0x80)) {
+					break;
+				}
+				cp = (cp << 6) | (cc & 0x3F);
+			}
+			if (i != seq_len) {
+				// Invalid or truncated sequence.
+				// Skip the valid part of the sequence.
+				*out++ = UNICODE_REPLACEMENT_CHAR;
+				p += i;
+				continue;
+			}
+			p += seq_len;
+
+			if (cp >= 0x10000) {
+				// Surrogate pair.
+				cp -= 0x10000;
+				*out++ = static_cast<char16_t>(0xD800 | (cp >> 10));
+				*out++ = static_cast<char16_t>(0xDC00 | (cp & 0x3FF));
+			} else {
+				*out++ = static_cast<char16_t>(cp);
+			}
+		}
+	}
+
+	ret.resize(out - out_start);
 	return ret;
 }
+
+/** Batch conversion functions **/
+
+/**
+ * Start a batch conversion.
+ * @param out	[out] Batch output.
+ * @param count	[in] Number of strings.
+ * @param size	[in] Estimated size of the converted strings, in bytes.
+ */
+static inline void batch_init(TextBatch &out, size_t count, size_t size)
+{
+	out.data.clear();
+	// +1 for each NULL terminator.
+	out.data.reserve(size + count);
+	out.offsets.resize(count + 1);
+}
+
+/**
+ * Convert multiple 8-bit strings to UTF-8.
+ * The specified code page number will be used.
+ * @param cp	[in] Code page number.
+ * @param spans	[in] 8-bit text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ * @param flags	[in] Flags. (See TextConv_Flags_e.)
+ */
+void cpN_to_utf8_batch(unsigned int cp, const TextSpan *spans, size_t count, TextBatch &out, unsigned int flags)
+{
+	// NOTE: Assuming mostly-ASCII text for the size estimate.
+	size_t size = 0;
+	for (size_t i = 0; i < count; i++) {
+		size += spans[i].len;
+	}
+	batch_init(out, count, size);
+
+	const bool use_native = (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE));
+	for (size_t i = 0; i < count; i++) {
+		out.offsets[i] = out.data.size();
+		if (use_native && cp932_to_utf8_append(spans[i].str, spans[i].len, out.data)) {
+			// Converted using the native CP932 decoder.
+		} else if (spans[i].len != 0) {
+			// Use the OS-specific conversion function.
+			// This handles other code pages, and invalid CP932 text.
+			out.data += cpN_to_utf8(cp, spans[i].str, spans[i].len, flags);
+		}
+		out.data += '\0';
+	}
+	out.offsets[count] = out.data.size();
+}
+
+/**
+ * Convert multiple UTF-8 strings to 8-bit text.
+ * The specified code page number will be used.
+ * Strings with unmappable characters are left empty.
+ * @param cp	[in] Code page number.
+ * @param spans	[in] UTF-8 text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] 8-bit strings.
+ * @param flags	[in] Flags. (See TextConv_Flags_e.)
+ */
+void utf8_to_cpN_batch(unsigned int cp, const TextSpan *spans, size_t count, TextBatch &out, unsigned int flags)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < count; i++) {
+		size += spans[i].len;
+	}
+	batch_init(out, count, size);
+
+	const bool use_native = (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE));
+	for (size_t i = 0; i < count; i++) {
+		out.offsets[i] = out.data.size();
+		if (use_native) {
+			// Use the native CP932 encoder.
+			// NOTE: On error, the string is left empty, like utf8_to_cpN().
+			utf8_to_cp932_append(spans[i].str, spans[i].len, out.data);
+		} else if (spans[i].len != 0) {
+			// Use the OS-specific conversion function.
+			out.data += utf8_to_cpN(cp, spans[i].str, spans[i].len, flags);
+		}
+		out.data += '\0';
+	}
+	out.offsets[count] = out.data.size();
+}
+
+/**
+ * Convert multiple UTF-16 strings to UTF-8.
+ * @tparam bswap If true, byteswap the text.
+ * @param spans	[in] UTF-16 text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ */
+template<bool bswap>
+static inline void T_utf16_to_utf8_batch(const TextSpan16 *spans, size_t count, TextBatch &out)
+{
+	// NOTE: Assuming mostly-ASCII text for the size estimate.
+	size_t size = 0;
+	for (size_t i = 0; i < count; i++) {
+		size += spans[i].len;
+	}
+	batch_init(out, count, size);
+
+	for (size_t i = 0; i < count; i++) {
+		out.offsets[i] = out.data.size();
+		if (spans[i].len != 0) {
+			T_utf16_to_utf8<bswap>(out.data, spans[i].str, spans[i].len);
+		}
+		out.data += '\0';
+	}
+	out.offsets[count] = out.data.size();
+}
+
+/**
+ * Convert multiple UTF-16LE strings to UTF-8.
+ * Unpaired surrogates are converted to U+FFFD.
+ * @param spans	[in] UTF-16LE text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ */
+void utf16le_to_utf8_batch(const TextSpan16 *spans, size_t count, TextBatch &out)
+{
+#if SYS_BYTEORDER == SYS_LIL_ENDIAN
+	T_utf16_to_utf8_batch<false>(spans, count, out);
+#else /* SYS_BYTEORDER == SYS_BIG_ENDIAN */
+	T_utf16_to_utf8_batch<true>(spans, count, out);
+#endif
+}
+
+/**
+ * Convert multiple UTF-16BE strings to UTF-8.
+ * Unpaired surrogates are converted to U+FFFD.
+ * @param spans	[in] UTF-16BE text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ */
+void utf16be_to_utf8_batch(const TextSpan16 *spans, size_t count, TextBatch &out)
+{
+#if SYS_BYTEORDER == SYS_LIL_ENDIAN
+	T_utf16_to_utf8_batch<true>(spans, count, out);
+#else /* SYS_BYTEORDER == SYS_BIG_ENDIAN */
+	T_utf16_to_utf8_batch<false>(spans, count, out);
+#endif
+}
@@ -12,6 +12,7 @@
 
 // C++ includes.
 #include <string>
+#include <vector>
 
 /** Text conversion functions **/
 
@@ -30,6 +31,11 @@ typedef enum {
 	// Enable cp1252 fallback if the text fails to
 	// decode using the specified code page.
 	TEXTCONV_FLAG_CP1252_FALLBACK		= (1 << 0),
+
+	// Don't use the native CP932 codec. The OS-specific
+	// conversion functions (iconv or Win32) will be used instead.
+	// This is mostly useful for benchmarking.
+	TEXTCONV_FLAG_NO_NATIVE			= (1 << 1),
 } TextConv_Flags_e;
 
 /**
@@ -40,11 +46,11 @@ typedef enum {
  *
  * @param cp	[in] Code page number.
  * @param str	[in] 8-bit text.
- * @param len	[in] Length of str, in bytes. (-1 for NULL-terminated string)
+ * @param len	[in] Length of str, in bytes.
  * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return UTF-8 string.
  */
-std::string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int flags = 0);
+std::string cpN_to_utf8(unsigned int cp, const char *str, size_t len, unsigned int flags = 0);
 
 /**
  * Convert 8-bit text to UTF-16.
@@ -58,7 +64,7 @@ std::string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int
  * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return UTF-16 string.
  */
-std::u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned int flags = 0);
+std::u16string cpN_to_utf16(unsigned int cp, const char *str, size_t len, unsigned int flags = 0);
 
 /**
  * Convert UTF-8 to 8-bit text.
@@ -70,23 +76,76 @@ std::u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned
  * @param cp	[in] Code page number.
  * @param str	[in] UTF-8 text.
  * @param len	[in] Length of str, in bytes.
+ * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return 8-bit text.
  */
-std::string utf8_to_cpN(unsigned int cp, const char *str, int len);
+std::string utf8_to_cpN(unsigned int cp, const char *str, size_t len, unsigned int flags = 0);
+
+/* Native CP932 conversion functions */
+// These are used by cpN_to_utf8(), cpN_to_utf16(), and utf8_to_cpN()
+// for cp932, so the output doesn't depend on the system's iconv,
+// unless TEXTCONV_FLAG_NO_NATIVE is specified.
+
+/**
+ * Convert CP932 text to UTF-8.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] CP932 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param out	[out] UTF-8 string.
+ * @return True on success; false if str has invalid CP932 sequences.
+ */
+bool cp932_to_utf8(const char *str, size_t len, std::string &out);
+
+/**
+ * Convert CP932 text to UTF-8, appending it to a string.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] CP932 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param out	[in/out] UTF-8 string. (On error, it will be left unchanged.)
+ * @return True on success; false if str has invalid CP932 sequences.
+ */
+bool cp932_to_utf8_append(const char *str, size_t len, std::string &out);
+
+/**
+ * Convert CP932 text to UTF-16.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] CP932 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param out	[out] UTF-16 string.
+ * @return True on success; false if str has invalid CP932 sequences.
+ */
+bool cp932_to_utf16(const char *str, size_t len, std::u16string &out);
+
+/**
+ * Convert UTF-8 text to CP932.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] UTF-8 text.
+ * @param len	[in] Length of str, in bytes.
+ * @return CP932 text, or empty string if str has invalid UTF-8 sequences or unmappable characters.
+ */
+std::string utf8_to_cp932(const char *str, size_t len);
+
+/**
+ * Convert UTF-8 text to CP932, appending it to a string.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] UTF-8 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param ret	[in/out] CP932 string. (On error, it will be left unchanged.)
+ * @return True on success; false if str has invalid UTF-8 sequences or unmappable characters.
+ */
+bool utf8_to_cp932_append(const char *str, size_t len, std::string &ret);
 
 /* UTF-8 to UTF-16 and vice-versa */
 
 /**
  * Convert UTF-8 text to UTF-16.
  * WARNING: This function does NOT support NULL-terminated strings!
+ * Invalid sequences are converted to U+FFFD.
  * @param str	[in] UTF-8 text.
  * @param len	[in] Length of str, in bytes.
- * @return UTF-16 string.
+ * @return UTF-16 string. (host-endian)
  */
-static inline std::u16string utf8_to_utf16(const char *str, size_t len)
-{
-	return cpN_to_utf16(CP_UTF8, str, static_cast<int>(len));
-}
+std::u16string utf8_to_utf16(const char *str, size_t len);
 
 /**
  * Convert UTF-8 text to UTF-16.
@@ -96,7 +155,7 @@ static inline std::u16string utf8_to_utf16(const char *str, size_t len)
  */
 static inline std::u16string utf8_to_utf16(const std::string &str)
 {
-	return cpN_to_utf16(CP_UTF8, str.data(), static_cast<int>(str.size()));
+	return utf8_to_utf16(str.data(), str.size());
 }
 
 /* Specialized UTF-16 conversion functions */
@@ -104,6 +163,7 @@ static inline std::u16string utf8_to_utf16(const std::string &str)
 /**
  * Convert UTF-16LE text to UTF-8.
  * WARNING: This function does NOT support NULL-terminated strings!
+ * Unpaired surrogates are converted to U+FFFD.
  * @param wcs	[in] UTF-16LE text.
  * @param len	[in] Length of wcs, in characters.
  * @return UTF-8 string.
@@ -123,6 +183,7 @@ inline std::string utf16le_to_utf8(const std::u16string &wcs)
 /**
  * Convert UTF-16BE text to UTF-8.
  * WARNING: This function does NOT support NULL-terminated strings!
+ * Unpaired surrogates are converted to U+FFFD.
  * @param wcs	[in] UTF-16BE text.
  * @param len	[in] Length of wcs, in characters.
  * @return UTF-8 string.
@@ -139,6 +200,22 @@ inline std::string utf16be_to_utf8(const std::u16string &wcs)
 	return utf16be_to_utf8(wcs.data(), wcs.size());
 }
 
+/**
+ * Convert UTF-16 host-endian text to UTF-8.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param wcs	[in] UTF-16 host-endian text.
+ * @param len	[in] Length of wcs, in characters.
+ * @return UTF-8 text.
+ */
+static inline std::string utf16_to_utf8(const char16_t *wcs, size_t len)
+{
+#if SYS_BYTEORDER == SYS_LIL_ENDIAN
+	return utf16le_to_utf8(wcs, len);
+#else /* SYS_BYTEORDER == SYS_BIG_ENDIAN */
+	return utf16be_to_utf8(wcs, len);
+#endif
+}
+
 /**
  * Convert UTF-16 host-endian text to UTF-8.
  * @param wcs	[in] UTF-16 host-endian text.
@@ -164,6 +241,27 @@ static inline std::string utf16_to_utf8(const std::u16string &wcs)
  */
 std::u16string utf16_bswap(const char16_t *wcs, size_t len);
 
+/**
+ * Get the length of NULL-terminated UTF-16 text.
+ * NULL is 0 in both endiannesses, so wcs may be in either one.
+ * @param wcs	[in] UTF-16 text.
+ * @param maxLen	[in] Maximum length of wcs, in characters.
+ * @return Length of wcs, in characters. (maxLen if no NULL terminator was found)
+ */
+size_t utf16_nlen(const char16_t *wcs, size_t maxLen);
+
+/**
+ * Copy NULL-terminated UTF-16 text, optionally byteswapping it.
+ * The NULL terminator is located first, so the output string
+ * is allocated once at its final size.
+ * NOTE: Unlike most functions here, this one *does* stop at a NULL terminator.
+ * @param wcs	[in] UTF-16 text.
+ * @param maxLen	[in] Maximum length of wcs, in characters.
+ * @param bswap	[in] If true, byteswap the text.
+ * @return UTF-16 string, up to but not including the NULL terminator.
+ */
+std::u16string utf16_scan_copy(const char16_t *wcs, size_t maxLen, bool bswap);
+
 /**
  * Convert UTF-16LE text to host-endian UTF-16.
  * WARNING: This function does NOT support NULL-terminated strings!
@@ -171,7 +269,7 @@ std::u16string utf16_bswap(const char16_t *wcs, size_t len);
  * @param len Length of wcs, in characters.
  * @return Host-endian UTF-16 string.
  */
-static inline std::u16string utf16le_to_utf16(const char16_t *wcs, int len)
+static inline std::u16string utf16le_to_utf16(const char16_t *wcs, size_t len)
 {
 #if SYS_BYTEORDER == SYS_LIL_ENDIAN
 	return std::u16string(wcs, len);
@@ -187,7 +285,7 @@ static inline std::u16string utf16le_to_utf16(const char16_t *wcs, int len)
  * @param len Length of wcs, in characters.
  * @return Host-endian UTF-16 string.
  */
-static inline std::u16string utf16be_to_utf16(const char16_t *wcs, int len)
+static inline std::u16string utf16be_to_utf16(const char16_t *wcs, size_t len)
 {
 #if SYS_BYTEORDER == SYS_LIL_ENDIAN
 	return utf16_bswap(wcs, len);
@@ -195,3 +293,118 @@ static inline std::u16string utf16be_to_utf16(const char16_t *wcs, int len)
 	return std::u16string(wcs, len);
 #endif
 }
+
+/* Batch conversion functions */
+// These convert many strings in a single call. All of the converted
+// strings are stored in one buffer, so there's no per-string allocation.
+
+/**
+ * 8-bit text span for batch conversion.
+ */
+struct TextSpan {
+	const char *str;	// Text. (not NULL-terminated)
+	size_t len;		// Length of str, in bytes.
+};
+
+/**
+ * UTF-16 text span for batch conversion.
+ */
+struct TextSpan16 {
+	const char16_t *str;	// Text. (not NULL-terminated)
+	size_t len;		// Length of str, in characters.
+};
+
+/**
+ * Output of a batch conversion.
+ * Each converted string is NULL-terminated within data.
+ */
+struct TextBatch {
+	std::string data;		// Converted strings.
+	std::vector<size_t> offsets;	// Start of each string in data, plus data.size() at the end.
+
+	/**
+	 * Get the number of strings.
+	 * @return Number of strings.
+	 */
+	size_t count(void) const
+	{
+		return (offsets.empty() ? 0 : offsets.size() - 1);
+	}
+
+	/**
+	 * Get a converted string.
+	 * @param i String index.
+	 * @return NULL-terminated string.
+	 */
+	const char *str(size_t i) const
+	{
+		return &data[offsets[i]];
+	}
+
+	/**
+	 * Get the length of a converted string.
+	 * @param i String index.
+	 * @return Length, in bytes. (not including the NULL terminator)
+	 */
+	size_t len(size_t i) const
+	{
+		return offsets[i + 1] - offsets[i] - 1;
+	}
+};
+
+/**
+ * Convert multiple 8-bit strings to UTF-8.
+ * The specified code page number will be used.
+ * @param cp	[in] Code page number.
+ * @param spans	[in] 8-bit text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ * @param flags	[in] Flags. (See TextConv_Flags_e.)
+ */
+void cpN_to_utf8_batch(unsigned int cp, const TextSpan *spans, size_t count, TextBatch &out, unsigned int flags = 0);
+
+/**
+ * Convert multiple UTF-8 strings to 8-bit text.
+ * The specified code page number will be used.
+ * Strings with unmappable characters are left empty.
+ * @param cp	[in] Code page number.
+ * @param spans	[in] UTF-8 text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] 8-bit strings.
+ * @param flags	[in] Flags. (See TextConv_Flags_e.)
+ */
+void utf8_to_cpN_batch(unsigned int cp, const TextSpan *spans, size_t count, TextBatch &out, unsigned int flags = 0);
+
+/**
+ * Convert multiple UTF-16LE strings to UTF-8.
+ * Unpaired surrogates are converted to U+FFFD.
+ * @param spans	[in] UTF-16LE text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ */
+void utf16le_to_utf8_batch(const TextSpan16 *spans, size_t count, TextBatch &out);
+
+/**
+ * Convert multiple UTF-16BE strings to UTF-8.
+ * Unpaired surrogates are converted to U+FFFD.
+ * @param spans	[in] UTF-16BE text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ */
+void utf16be_to_utf8_batch(const TextSpan16 *spans, size_t count, TextBatch &out);
+
+/**
+ * Convert multiple UTF-16 host-endian strings to UTF-8.
+ * Unpaired surrogates are converted to U+FFFD.
+ * @param spans	[in] UTF-16 host-endian text spans.
+ * @param count	[in] Number of spans.
+ * @param out	[out] UTF-8 strings.
+ */
+static inline void utf16_to_utf8_batch(const TextSpan16 *spans, size_t count, TextBatch &out)
+{
+#if SYS_BYTEORDER == SYS_LIL_ENDIAN
+	utf16le_to_utf8_batch(spans, count, out);
+#else /* SYS_BYTEORDER == SYS_BIG_ENDIAN */
+	utf16be_to_utf8_batch(spans, count, out);
+#endif
+}
@@ -0,0 +1,302 @@
+/***************************************************************************
+ * MST Decoder/Encoder for Sonic '06                                       *
+ * TextFuncs_cp932.cpp: Text encoding functions. (native CP932)            *
+ *                                                                         *
+ * Copyright (c) 2019-2025 by David Korth.                                 *
+ * SPDX-License-Identifier: MIT                                            *
+ ***************************************************************************/
+
+#include "TextFuncs.hpp"
+#include "common.h"
+
+// C++ includes.
+#include <string>
+using std::string;
+using std::u16string;
+
+// CP932 conversion tables.
+#include "cp932_tables.h"
+
+/**
+ * Get the length of the run of ASCII characters at the start of a string.
+ * CP932 is ASCII-compatible, and message names are almost always ASCII,
+ * so ASCII runs can be copied as-is.
+ * @param p	[in] Text.
+ * @param len	[in] Length of p, in bytes.
+ * @return Number of leading ASCII bytes.
+ */
+static FORCEINLINE size_t ascii_run_length(const uint8_t *p, size_t len)
+{
+	size_t pos = 0;
+#ifdef HAVE_SSE2
+	for (; len - pos >= 16; pos += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p[pos]));
+		const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(v));
+		if (mask != 0) {
+			// Found a non-ASCII byte.
+			unsigned int i = 0;
+			while (!(mask & (1U << i)))
+				i++;
+			return pos + i;
+		}
+	}
+#endif /* HAVE_SSE2 */
+	for (; pos < len; pos++) {
+		if (p[pos] >= 0x80)
+			break;
+	}
+	return pos;
+}
+
+/**
+ * Decode a CP932 character.
+ * @param p	[in/out] Pointer into the CP932 text. Advanced past the character.
+ * @param p_end	[in] End of the CP932 text.
+ * @return UTF-16 code point, or 0 if invalid.
+ */
+static inline char16_t cp932_decode_char(const uint8_t *&p, const uint8_t *p_end)
+{
+	const uint8_t lead = *p++;
+	if (lead < 0x80) {
+		// ASCII.
+		// NOTE: Returns 0 for NULL, but CP932 text never has
+		// embedded NULLs, since it's read from C strings.
+		return lead;
+	} else if (lead >= 0xA1 && lead <= 0xDF) {
+		// Halfwidth katakana.
+		return 0xFF61 + (lead - 0xA1);
+	}
+
+	unsigned int row;
+	if (lead >= 0x81 && lead <= 0x9F) {
+		row = lead - 0x81;
+	} else if (lead >= 0xE0 && lead <= 0xFC) {
+		row = lead - 0xE0 + (0x9F - 0x81 + 1);
+	} else {
+		// Invalid lead byte.
+		return 0;
+	}
+
+	if (p == p_end) {
+		// Missing trail byte.
+		return 0;
+	}
+	const uint8_t trail = *p++;
+	if (trail < CP932::TRAIL_MIN || trail > CP932::TRAIL_MAX) {
+		// Invalid trail byte.
+		return 0;
+	}
+	return CP932::dec_tbl[row][trail - CP932::TRAIL_MIN];
+}
+
+/**
+ * Convert CP932 text to UTF-8, appending it to a string.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] CP932 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param out	[in/out] UTF-8 string. (On error, it will be left unchanged.)
+ * @return True on success; false if str has invalid CP932 sequences.
+ */
+bool cp932_to_utf8_append(const char *str, size_t len, string &out)
+{
+	const uint8_t *p = reinterpret_cast<const uint8_t*>(str);
+	size_t run = ascii_run_length(p, len);
+	if (run == len) {
+		// The entire string is ASCII.
+		out.append(str, len);
+		return true;
+	}
+
+	const size_t start = out.size();
+	// Worst case: Each byte becomes a 3-byte UTF-8 sequence.
+	// (Halfwidth katakana)
+	out.reserve(start + (len * 3));
+
+	const uint8_t *const p_end = p + len;
+	while (p < p_end) {
+		if (run > 0) {
+			// ASCII run.
+			out.append(reinterpret_cast<const char*>(p), run);
+			p += run;
+			if (p == p_end)
+				break;
+		}
+
+		const char16_t wc = cp932_decode_char(p, p_end);
+		if (wc == 0) {
+			// Invalid CP932 sequence.
+			out.resize(start);
+			return false;
+		}
+
+		if (wc < 0x800) {
+			out += static_cast<char>(0xC0 | (wc >> 6));
+			out += static_cast<char>(0x80 | (wc & 0x3F));
+		} else {
+			out += static_cast<char>(0xE0 | (wc >> 12));
+			out += static_cast<char>(0x80 | ((wc >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (wc & 0x3F));
+		}
+		run = ascii_run_length(p, p_end - p);
+	}
+	return true;
+}
+
+/**
+ * Convert CP932 text to UTF-8.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] CP932 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param out	[out] UTF-8 string.
+ * @return True on success; false if str has invalid CP932 sequences.
+ */
+bool cp932_to_utf8(const char *str, size_t len, string &out)
+{
+	out.clear();
+	return cp932_to_utf8_append(str, len, out);
+}
+
+/**
+ * Convert CP932 text to UTF-16.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] CP932 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param out	[out] UTF-16 string.
+ * @return True on success; false if str has invalid CP932 sequences.
+ */
+bool cp932_to_utf16(const char *str, size_t len, u16string &out)
+{
+	out.clear();
+	out.reserve(len);
+
+	const uint8_t *p = reinterpret_cast<const uint8_t*>(str);
+	const uint8_t *const p_end = p + len;
+	while (p < p_end) {
+		const size_t run = ascii_run_length(p, p_end - p);
+		if (run > 0) {
+			// ASCII run.
+			out.append(p, p + run);
+			p += run;
+			continue;
+		}
+
+		const char16_t wc = cp932_decode_char(p, p_end);
+		if (wc == 0) {
+			// Invalid CP932 sequence.
+			out.clear();
+			return false;
+		}
+		out += wc;
+	}
+	return true;
+}
+
+/**
+ * Convert UTF-8 text to CP932, appending it to a string.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] UTF-8 text.
+ * @param len	[in] Length of str, in bytes.
+ * @param ret	[in/out] CP932 string. (On error, it will be left unchanged.)
+ * @return True on success; false if str has invalid UTF-8 sequences or unmappable characters.
+ */
+bool utf8_to_cp932_append(const char *str, size_t len, string &ret)
+{
+	const uint8_t *p = reinterpret_cast<const uint8_t*>(str);
+	if (ascii_run_length(p, len) == len) {
+		// The entire string is ASCII.
+		ret.append(str, len);
+		return true;
+	}
+
+	// Every character is at most 2 bytes in CP932,
+	// and at least that many bytes in UTF-8.
+	const size_t start = ret.size();
+	ret.reserve(start + len);
+
+	const uint8_t *const p_end = p + len;
+	while (p < p_end) {
+		const uint8_t c = *p;
+		if (c < 0x80) {
+			// ASCII run.
+			const size_t run = ascii_run_length(p, p_end - p);
+			ret.append(reinterpret_cast<const char*>(p), run);
+			p += run;
+			continue;
+		}
+
+		// Decode the UTF-8 sequence.
+		// NOTE: Only BMP characters can be encoded in CP932,
+		// so 4-byte sequences are always unmappable.
+		unsigned int wc, seq_len;
+		if ((c & 0xE0) == 0xC0) {
+			wc = c & 0x1F;
+			seq_len = 2;
+		} else if ((c & 0xF0) == 0xE0) {
+			wc = c & 0x0F;
+			seq_len = 3;
+		} else if ((c & 0xF8) == 0xF0) {
+			wc = 0;
+			seq_len = 4;
+		} else {
+			// Invalid lead byte.
+			ret.resize(start);
+			return false;
+		}
+
+		if (static_cast<size_t>(p_end - p) < seq_len) {
+			// Truncated sequence.
+			ret.resize(start);
+			return false;
+		}
+		bool valid = true;
+		for (unsigned int i = 1; i < seq_len; i++) {
+			if ((p[i] & 0xC0) != 0x80) {
+				valid = false;
+				break;
+			}
+			wc = (wc << 6) | (p[i] & 0x3F);
+		}
+		if (!valid) {
+			// Invalid continuation byte.
+			ret.resize(start);
+			return false;
+		}
+		p += seq_len;
+		if (seq_len == 4) {
+			// Not in the BMP.
+			ret.resize(start);
+			return false;
+		}
+
+		// Look up the character in the encoding table.
+		const uint8_t page = CP932::enc_page_idx[wc >> 8];
+		const uint16_t sjis = (page != 0 ? CP932::enc_pages[page - 1][wc & 0xFF] : 0);
+		if (sjis == 0) {
+			// Unmappable character.
+			ret.resize(start);
+			return false;
+		} else if (sjis < 0x100) {
+			// Single-byte character.
+			ret += static_cast<char>(sjis);
+		} else {
+			// Double-byte character.
+			ret += static_cast<char>(sjis >> 8);
+			ret += static_cast<char>(sjis & 0xFF);
+		}
+	}
+	return true;
+}
+
+/**
+ * Convert UTF-8 text to CP932.
+ * WARNING: This function does NOT support NULL-terminated strings!
+ * @param str	[in] UTF-8 text.
+ * @param len	[in] Length of str, in bytes.
+ * @return CP932 text, or empty string if str has invalid UTF-8 sequences or unmappable characters.
+ */
+string utf8_to_cp932(const char *str, size_t len)
+{
+	string ret;
+	utf8_to_cp932_append(str, len, ret);
+	return ret;
+}
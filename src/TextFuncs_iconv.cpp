@@ -9,10 +9,16 @@
 #include "config.mst06.h"
 #include "TextFuncs.hpp"
 
+// C includes (C++ namespace)
+#include <cerrno>
+#include <cstring>
+
 // C++ includes.
 #include <string>
+#include <vector>
 using std::u16string;
 using std::string;
+using std::vector;
 
 // Determine the system encodings.
 #include "byteorder.h"
@@ -27,19 +33,93 @@ using std::string;
 
 /** OS-specific text conversion functions. **/
 
+/**
+ * Per-thread cache of open iconv descriptors.
+ * Opening an iconv descriptor is expensive, and the same few
+ * conversions are used for every string in a table.
+ */
+class IconvCache
+{
+public:
+	IconvCache() { }
+	~IconvCache()
+	{
+		for (auto iter = m_vEntries.begin(); iter != m_vEntries.end(); ++iter) {
+			iconv_close(iter->cd);
+		}
+	}
+
+	// Disable copying.
+	IconvCache(const IconvCache&) = delete;
+	IconvCache &operator=(const IconvCache&) = delete;
+
+public:
+	/**
+	 * Get an iconv descriptor, opening it if necessary.
+	 * The descriptor is reset to its initial state.
+	 * @param src_charset	[in] Source character set.
+	 * @param dest_charset	[in] Destination character set.
+	 * @return iconv descriptor, or (iconv_t)(-1) on error.
+	 */
+	iconv_t get(const char *src_charset, const char *dest_charset)
+	{
+		for (auto iter = m_vEntries.begin(); iter != m_vEntries.end(); ++iter) {
+			if (!strcmp(iter->src_charset.c_str(), src_charset) &&
+			    !strcmp(iter->dest_charset.c_str(), dest_charset))
+			{
+				// Found a cached descriptor.
+				// Reset its conversion state, since the previous
+				// conversion may have failed partway through.
+				iconv(iter->cd, nullptr, nullptr, nullptr, nullptr);
+				return iter->cd;
+			}
+		}
+
+		// Not cached. Open a new descriptor.
+		iconv_t cd = iconv_open(dest_charset, src_charset);
+		if (cd == (iconv_t)(-1)) {
+			// Error opening iconv.
+			return cd;
+		}
+
+		Entry entry;
+		entry.src_charset = src_charset;
+		entry.dest_charset = dest_charset;
+		entry.cd = cd;
+		m_vEntries.push_back(std::move(entry));
+		return cd;
+	}
+
+private:
+	struct Entry {
+		string src_charset;
+		string dest_charset;
+		iconv_t cd;
+	};
+	// NOTE: Only a handful of charset pairs are used,
+	// so a linear search is fine here.
+	vector<Entry> m_vEntries;
+};
+
 /**
  * Convert a string from one character set to another.
- * @param src 		[in] Source string.
- * @param len           [in] Source length, in bytes.
+ * The output is written directly into the string, which is grown
+ * as needed and trimmed to the converted length.
+ * @tparam T Output string type. (std::string or std::u16string)
+ * @param out		[out] Output string.
+ * @param src		[in] Source string.
+ * @param len		[in] Source length, in bytes.
  * @param src_charset	[in] Source character set.
  * @param dest_charset	[in] Destination character set.
- * @return malloc()'d UTF-8 string, or nullptr on error.
+ * @return True on success; false on error. (out will be empty)
  */
-static char *rp_iconv(const char *src, int len,
+template<typename T>
+static bool rp_iconv(T &out, const char *src, size_t len,
 		const char *src_charset, const char *dest_charset)
 {
-	if (!src || len <= 0)
-		return nullptr;
+	out.clear();
+	if (!src || len == 0)
+		return false;
 
 	if (!src_charset)
 		src_charset = "";
@@ -50,58 +130,54 @@ static char *rp_iconv(const char *src, int len,
 	// * http://www.delorie.com/gnu/docs/glibc/libc_101.html
 	// * http://www.codase.com/search/call?name=iconv
 
-	// Open an iconv descriptor.
-	iconv_t cd;
-	cd = iconv_open(dest_charset, src_charset);
+	// Get an iconv descriptor.
+	static thread_local IconvCache cache;
+	iconv_t cd = cache.get(src_charset, dest_charset);
 	if (cd == (iconv_t)(-1)) {
 		// Error opening iconv.
-		return nullptr;
+		return false;
 	}
 
-	// Allocate the output buffer.
-	// UTF-8 is variable length, and the largest UTF-8 character is 4 bytes long.
-	size_t src_bytes_len = (size_t)len;
-	const size_t out_bytes_len = (src_bytes_len * 4) + 4;
-	size_t out_bytes_remaining = out_bytes_len;
-	char *outbuf = static_cast<char*>(malloc(out_bytes_len));
+	// Initial output buffer size, in characters.
+	// This is enough for most conversions; if it isn't,
+	// iconv() returns E2BIG and the buffer is doubled.
+	typedef typename T::value_type char_type;
+	size_t out_chars = (sizeof(char_type) == 1 ? (len * 2) : len) + 4;
+	out.resize(out_chars);
 
 	// Input and output pointers.
 	char *inptr = const_cast<char*>(src);	// Input pointer.
-	char *outptr = &outbuf[0];		// Output pointer.
+	size_t src_bytes_len = len;
+	size_t out_bytes_used = 0;
 
-	bool success = true;
 	while (src_bytes_len > 0) {
-		if (iconv(cd, &inptr, &src_bytes_len, &outptr, &out_bytes_remaining) == (size_t)(-1)) {
-			// An error occurred while converting the string.
-			// FIXME: Flag to indicate that we want to have
-			// a partial Shift-JIS conversion?
-			// Madou Monogatari I (MD) has a broken Shift-JIS
-			// code point, which breaks conversion.
-			// (Reported by andlabs.)
-			success = false;
-			break;
+		char *outptr = reinterpret_cast<char*>(&out[0]) + out_bytes_used;
+		size_t out_bytes_remaining = (out_chars * sizeof(char_type)) - out_bytes_used;
+		const size_t ret = iconv(cd, &inptr, &src_bytes_len, &outptr, &out_bytes_remaining);
+		out_bytes_used = (out_chars * sizeof(char_type)) - out_bytes_remaining;
+		if (ret != (size_t)(-1))
+			continue;
+
+		if (errno == E2BIG) {
+			// Output buffer is full. Grow it and try again.
+			out_chars *= 2;
+			out.resize(out_chars);
+			continue;
 		}
-	}
 
-	// Close the iconv descriptor.
-	iconv_close(cd);
-
-	if (success) {
-		// The string was converted successfully.
-
-		// Make sure the string is null-terminated.
-		size_t null_bytes = (out_bytes_remaining > 4 ? 4 : out_bytes_remaining);
-		for (size_t i = null_bytes; i > 0; i--) {
-			*outptr++ = 0x00;
-		}
-
-		// Return the output buffer.
-		return outbuf;
+		// An error occurred while converting the string.
+		// FIXME: Flag to indicate that we want to have
+		// a partial Shift-JIS conversion?
+		// Madou Monogatari I (MD) has a broken Shift-JIS
+		// code point, which breaks conversion.
+		// (Reported by andlabs.)
+		out.clear();
+		return false;
 	}
 
-	// The string was not converted successfully.
-	free(outbuf);
-	return nullptr;
+	// The string was converted successfully.
+	out.resize(out_bytes_used / sizeof(char_type));
+	return true;
 }
 
 /** Generic code page functions. **/
@@ -144,12 +220,21 @@ static inline void codePageToEncName(char *enc_name, size_t len, unsigned int cp
  *
  * @param cp	[in] Code page number.
  * @param str	[in] 8-bit text.
- * @param len	[in] Length of str, in bytes. (-1 for NULL-terminated string)
+ * @param len	[in] Length of str, in bytes.
  * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return UTF-8 string.
  */
-string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int flags)
+string cpN_to_utf8(unsigned int cp, const char *str, size_t len, unsigned int flags)
 {
+	string ret;
+	if (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE)) {
+		// Use the native CP932 decoder.
+		// If the text isn't valid CP932, use iconv and its fallbacks.
+		if (cp932_to_utf8(str, len, ret)) {
+			return ret;
+		}
+	}
+
 	// Get the encoding name for the primary code page.
 	char cp_name[20];
 	codePageToEncName(cp_name, sizeof(cp_name), cp, flags);
@@ -157,41 +242,35 @@ string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int flags
 	// Attempt to convert the text to UTF-8.
 	// NOTE: "//IGNORE" sometimes doesn't work, so we won't
 	// check for TEXTCONV_FLAG_CP1252_FALLBACK here.
-	string ret;
-	char *mbs = reinterpret_cast<char*>(rp_iconv((char*)str, len*sizeof(*str), cp_name, "UTF-8"));
-	if (!mbs /*&& (flags & TEXTCONV_FLAG_CP1252_FALLBACK)*/) {
+	bool ok = rp_iconv(ret, str, len, cp_name, "UTF-8");
+	if (!ok /*&& (flags & TEXTCONV_FLAG_CP1252_FALLBACK)*/) {
 		// Try cp1252 fallback.
 		if (cp != 1252) {
-			mbs = reinterpret_cast<char*>(rp_iconv((char*)str, len*sizeof(*str), "CP1252//IGNORE", "UTF-8"));
+			ok = rp_iconv(ret, str, len, "CP1252//IGNORE", "UTF-8");
 		}
-		if (!mbs) {
+		if (!ok) {
 			// Try Latin-1 fallback.
 			if (cp != CP_LATIN1) {
-				mbs = reinterpret_cast<char*>(rp_iconv((char*)str, len*sizeof(*str), "LATIN1//IGNORE", "UTF-8"));
+				ok = rp_iconv(ret, str, len, "LATIN1//IGNORE", "UTF-8");
 			}
 		}
 	}
 
-	if (mbs) {
-		ret.assign(mbs);
-		free(mbs);
-
 #ifdef HAVE_ICONV_LIBICONV
-		if (cp == 932) {
-			// libiconv's cp932 maps Shift-JIS 8160 to U+301C. This is expected
-			// behavior for Shift-JIS, but cp932 should map it to U+FF5E.
-			for (auto p = ret.begin(); p != ret.end(); ++p) {
-				if ((uint8_t)p[0] == 0xE3 && (uint8_t)p[1] == 0x80 && (uint8_t)p[2] == 0x9C) {
-					// Found a wave dash.
-					p[0] = (uint8_t)0xEF;
-					p[1] = (uint8_t)0xBD;
-					p[2] = (uint8_t)0x9E;
-					p += 2;
-				}
+	if (ok && cp == 932) {
+		// libiconv's cp932 maps Shift-JIS 8160 to U+301C. This is expected
+		// behavior for Shift-JIS, but cp932 should map it to U+FF5E.
+		for (size_t i = 0; i + 2 < ret.size(); i++) {
+			if ((uint8_t)ret[i] == 0xE3 && (uint8_t)ret[i+1] == 0x80 && (uint8_t)ret[i+2] == 0x9C) {
+				// Found a wave dash.
+				ret[i]   = (uint8_t)0xEF;
+				ret[i+1] = (uint8_t)0xBD;
+				ret[i+2] = (uint8_t)0x9E;
+				i += 2;
 			}
 		}
-#endif /* HAVE_ICONV_LIBICONV */
 	}
+#endif /* HAVE_ICONV_LIBICONV */
 	return ret;
 }
 
@@ -203,12 +282,21 @@ string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int flags
  *
  * @param cp	[in] Code page number.
  * @param str	[in] 8-bit text.
- * @param len	[in] Length of str, in bytes. (-1 for NULL-terminated string)
+ * @param len	[in] Length of str, in bytes.
  * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return UTF-16 string.
  */
-u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned int flags)
+u16string cpN_to_utf16(unsigned int cp, const char *str, size_t len, unsigned int flags)
 {
+	u16string ret;
+	if (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE)) {
+		// Use the native CP932 decoder.
+		// If the text isn't valid CP932, use iconv and its fallbacks.
+		if (cp932_to_utf16(str, len, ret)) {
+			return ret;
+		}
+	}
+
 	// Get the encoding name for the primary code page.
 	char cp_name[20];
 	codePageToEncName(cp_name, sizeof(cp_name), cp, flags);
@@ -216,38 +304,32 @@ u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned int f
 	// Attempt to convert the text to UTF-16.
 	// NOTE: "//IGNORE" sometimes doesn't work, so we won't
 	// check for TEXTCONV_FLAG_CP1252_FALLBACK here.
-	u16string ret;
-	char16_t *wcs = reinterpret_cast<char16_t*>(rp_iconv((char*)str, len*sizeof(*str), cp_name, ICONV_UTF16_ENCODING));
-	if (!wcs /*&& (flags & TEXTCONV_FLAG_CP1252_FALLBACK)*/) {
+	bool ok = rp_iconv(ret, str, len, cp_name, ICONV_UTF16_ENCODING);
+	if (!ok /*&& (flags & TEXTCONV_FLAG_CP1252_FALLBACK)*/) {
 		// Try cp1252 fallback.
 		if (cp != 1252) {
-			wcs = reinterpret_cast<char16_t*>(rp_iconv((char*)str, len*sizeof(*str), "CP1252//IGNORE", ICONV_UTF16_ENCODING));
+			ok = rp_iconv(ret, str, len, "CP1252//IGNORE", ICONV_UTF16_ENCODING);
 		}
-		if (!wcs) {
+		if (!ok) {
 			// Try Latin-1 fallback.
 			if (cp != CP_LATIN1) {
-				wcs = reinterpret_cast<char16_t*>(rp_iconv((char*)str, len*sizeof(*str), "LATIN1//IGNORE", ICONV_UTF16_ENCODING));
+				ok = rp_iconv(ret, str, len, "LATIN1//IGNORE", ICONV_UTF16_ENCODING);
 			}
 		}
 	}
 
-	if (wcs) {
-		ret.assign(wcs);
-		free(wcs);
-
 #ifdef HAVE_ICONV_LIBICONV
-		if (cp == 932) {
-			// libiconv's cp932 maps Shift-JIS 8160 to U+301C. This is expected
-			// behavior for Shift-JIS, but cp932 should map it to U+FF5E.
-			for (auto p = ret.begin(); p != ret.end(); ++p) {
-				if (*p == 0x301C) {
-					// Found a wave dash.
-					*p = (char16_t)0xFF5E;
-				}
+	if (ok && cp == 932) {
+		// libiconv's cp932 maps Shift-JIS 8160 to U+301C. This is expected
+		// behavior for Shift-JIS, but cp932 should map it to U+FF5E.
+		for (auto p = ret.begin(); p != ret.end(); ++p) {
+			if (*p == 0x301C) {
+				// Found a wave dash.
+				*p = (char16_t)0xFF5E;
 			}
 		}
-#endif /* HAVE_ICONV_LIBICONV */
 	}
+#endif /* HAVE_ICONV_LIBICONV */
 	return ret;
 }
 
@@ -260,71 +342,23 @@ u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned int f
  *
  * @param cp	[in] Code page number.
  * @param str	[in] UTF-8 text.
- * @param len	[in] Length of str, in bytes. (-1 for NULL-terminated string)
+ * @param len	[in] Length of str, in bytes.
+ * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return 8-bit text.
  */
-string utf8_to_cpN(unsigned int cp, const char *str, int len)
+string utf8_to_cpN(unsigned int cp, const char *str, size_t len, unsigned int flags)
 {
+	if (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE)) {
+		// Use the native CP932 encoder.
+		return utf8_to_cp932(str, len);
+	}
+
 	// Get the encoding name for the primary code page.
 	char cp_name[20];
 	codePageToEncName(cp_name, sizeof(cp_name), cp, TEXTCONV_FLAG_CP1252_FALLBACK);
 
 	// Attempt to convert the text from UTF-8.
 	string ret;
-	char *mbs = reinterpret_cast<char*>(rp_iconv((char*)str, len*sizeof(*str), "UTF-8", cp_name));
-	if (mbs) {
-		ret.assign(mbs);
-		free(mbs);
-	}
-	return ret;
-}
-
-/** Unicode to Unicode conversion functions **/
-
-/**
- * Convert UTF-16LE text to UTF-8.
- * WARNING: This function does NOT support NULL-terminated strings!
- * @param wcs	[in] UTF-16LE text.
- * @param len	[in] Length of wcs, in characters.
- * @return UTF-8 string.
- */
-std::string utf16le_to_utf8(const char16_t *wcs, size_t len)
-{
-	if (!wcs || !*wcs || len == 0) {
-		// Empty string.
-		return string();
-	}
-
-	// Attempt to convert the text from UTF-16LE to UTF-8.
-	string ret;
-	char *mbs = reinterpret_cast<char*>(rp_iconv((char*)wcs, len*sizeof(char16_t), "UTF-16LE", "UTF-8"));
-	if (mbs) {
-		ret.assign(mbs);
-		free(mbs);
-	}
-	return ret;
-}
-
-/**
- * Convert UTF-16BE text to UTF-8.
- * WARNING: This function does NOT support NULL-terminated strings!
- * @param wcs	[in] UTF-16BE text.
- * @param len	[in] Length of wcs, in characters.
- * @return UTF-8 string.
- */
-std::string utf16be_to_utf8(const char16_t *wcs, size_t len)
-{
-	if (!wcs || !*wcs || len == 0) {
-		// Empty string.
-		return string();
-	}
-
-	// Attempt to convert the text from UTF-16BE to UTF-8.
-	string ret;
-	char *mbs = reinterpret_cast<char*>(rp_iconv((char*)wcs, len*sizeof(char16_t), "UTF-16BE", "UTF-8"));
-	if (mbs) {
-		ret.assign(mbs);
-		free(mbs);
-	}
+	rp_iconv(ret, str, len, "UTF-8", cp_name);
 	return ret;
 }
@@ -19,6 +19,9 @@
 // Windows
 #include <windows.h>
 
+// C includes (C++ namespace)
+#include <climits>
+
 // C++ includes.
 #include <string>
 using std::string;
@@ -127,8 +130,22 @@ static char *W32U_UTF16_to_mbs(const char16_t *wcs, int cchWcs,
  * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return UTF-8 string.
  */
-string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int flags)
+string cpN_to_utf8(unsigned int cp, const char *str, size_t len, unsigned int flags)
 {
+	string ret;
+	if (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE)) {
+		// Use the native CP932 decoder.
+		// If the text isn't valid CP932, use the Win32 conversion and its fallbacks.
+		if (cp932_to_utf8(str, len, ret)) {
+			return ret;
+		}
+	}
+
+	if (len > INT_MAX) {
+		// MultiByteToWideChar() only supports int lengths.
+		return ret;
+	}
+
 	DWORD dwFlags = 0;
 	if (flags & TEXTCONV_FLAG_CP1252_FALLBACK) {
 		// Fallback is enabled.
@@ -137,13 +154,12 @@ string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int flags
 	}
 
 	// Convert from `cp` to UTF-16.
-	string ret;
 	int cchWcs;
-	char16_t *wcs = W32U_mbs_to_UTF16(str, len, cp, &cchWcs, dwFlags);
+	char16_t *wcs = W32U_mbs_to_UTF16(str, static_cast<int>(len), cp, &cchWcs, dwFlags);
 	if (!wcs || cchWcs == 0) {
 		if (flags & TEXTCONV_FLAG_CP1252_FALLBACK) {
 			// Try again using cp1252.
-			wcs = W32U_mbs_to_UTF16(str, len, 1252, &cchWcs, 0);
+			wcs = W32U_mbs_to_UTF16(str, static_cast<int>(len), 1252, &cchWcs, 0);
 		}
 	}
 
@@ -177,8 +193,22 @@ string cpN_to_utf8(unsigned int cp, const char *str, int len, unsigned int flags
  * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return UTF-16 string.
  */
-u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned int flags)
+u16string cpN_to_utf16(unsigned int cp, const char *str, size_t len, unsigned int flags)
 {
+	u16string ret;
+	if (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE)) {
+		// Use the native CP932 decoder.
+		// If the text isn't valid CP932, use the Win32 conversion and its fallbacks.
+		if (cp932_to_utf16(str, len, ret)) {
+			return ret;
+		}
+	}
+
+	if (len > INT_MAX) {
+		// MultiByteToWideChar() only supports int lengths.
+		return ret;
+	}
+
 	DWORD dwFlags = 0;
 	if (flags & TEXTCONV_FLAG_CP1252_FALLBACK) {
 		// Fallback is enabled.
@@ -187,13 +217,12 @@ u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned int f
 	}
 
 	// Convert from `cp` to UTF-16.
-	u16string ret;
 	int cchWcs;
-	char16_t *wcs = W32U_mbs_to_UTF16(str, len, cp, &cchWcs, dwFlags);
+	char16_t *wcs = W32U_mbs_to_UTF16(str, static_cast<int>(len), cp, &cchWcs, dwFlags);
 	if (!wcs || cchWcs == 0) {
 		if (flags & TEXTCONV_FLAG_CP1252_FALLBACK) {
 			// Try again using cp1252.
-			wcs = W32U_mbs_to_UTF16(str, len, 1252, &cchWcs, 0);
+			wcs = W32U_mbs_to_UTF16(str, static_cast<int>(len), 1252, &cchWcs, 0);
 		}
 	}
 
@@ -218,14 +247,25 @@ u16string cpN_to_utf16(unsigned int cp, const char *str, int len, unsigned int f
  * @param cp	[in] Code page number.
  * @param str	[in] UTF-8 text.
  * @param len	[in] Length of str, in bytes.
+ * @param flags	[in] Flags. (See TextConv_Flags_e.)
  * @return 8-bit text.
  */
-string utf8_to_cpN(unsigned int cp, const char *str, int len)
+string utf8_to_cpN(unsigned int cp, const char *str, size_t len, unsigned int flags)
 {
+	if (cp == 932 && !(flags & TEXTCONV_FLAG_NO_NATIVE)) {
+		// Use the native CP932 encoder.
+		return utf8_to_cp932(str, len);
+	}
+
+	if (len > INT_MAX) {
+		// MultiByteToWideChar() only supports int lengths.
+		return string();
+	}
+
 	// Convert from UTF-8 to UTF-16.
 	string ret;
 	int cchWcs;
-	char16_t *wcs = W32U_mbs_to_UTF16(str, len, CP_UTF8, &cchWcs, 0);
+	char16_t *wcs = W32U_mbs_to_UTF16(str, static_cast<int>(len), CP_UTF8, &cchWcs, 0);
 	if (wcs && cchWcs > 0) {
 		// Convert from UTF-16 to `cp`.
 		int cbMbs;
@@ -243,76 +283,3 @@ string utf8_to_cpN(unsigned int cp, const char *str, int len)
 	free(wcs);
 	return ret;
 }
-
-/**
- * Convert UTF-16 to 8-bit text.
- * WARNING: This function does NOT support NULL-terminated strings!
- *
- * The specified code page number will be used.
- * Invalid characters will be ignored.
- *
- * @param cp	[in] Code page number.
- * @param wcs	[in] UTF-16 text.
- * @param len	[in] Length of str, in bytes.
- * @return 8-bit text.
- */
-static string utf16_to_cpN(unsigned int cp, const char16_t *wcs, int len)
-{
-	// Convert from UTF-16 to `cp`.
-	string ret;
-	int cbMbs;
-	char *mbs = W32U_UTF16_to_mbs(wcs, len, cp, &cbMbs);
-	if (mbs && cbMbs > 0) {
-		// Remove the NULL terminator if present.
-		if (mbs[cbMbs-1] == 0) {
-			cbMbs--;
-		}
-		ret.assign(mbs, cbMbs);
-	}
-	free(mbs);
-	return ret;
-}
-
-/** Specialized UTF-16 conversion functions. **/
-
-/**
- * Convert UTF-16LE text to UTF-8.
- * WARNING: This function does NOT support NULL-terminated strings!
- * @param wcs	[in] UTF-16LE text.
- * @param len	[in] Length of wcs, in characters.
- * @return UTF-8 string.
- */
-string utf16le_to_utf8(const char16_t *wcs, size_t len)
-{
-	// Wrapper around utf16_to_cpN().
-	return utf16_to_cpN(CP_UTF8, wcs, static_cast<int>(len));
-}
-
-/**
- * Convert UTF-16BE text to UTF-8.
- * WARNING: This function does NOT support NULL-terminated strings!
- * @param wcs	[in] UTF-16BE text.
- * @param len	[in] Length of wcs, in characters.
- * @return UTF-8 string.
- */
-string utf16be_to_utf8(const char16_t *wcs, size_t len)
-{
-	if (!wcs || !*wcs || len == 0) {
-		// Empty string.
-		return string();
-	}
-
-	// WideCharToMultiByte() doesn't support UTF-16BE.
-	// Byteswap the text first.
-	u16string bwcs = utf16_bswap(wcs, len);
-	if (bwcs.empty()) {
-		// Error byteswapping the string...
-		return string();
-	} else if (len != bwcs.size()) {
-		// Byteswapping failed.
-		return string();
-	}
-
-	// Convert the byteswapped text.
-	return utf16_to_cpN(CP_UTF8, bwcs.data(), static_cast<int>(bwcs.size()));
-}
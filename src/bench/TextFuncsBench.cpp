@@ -0,0 +1,398 @@
+/***************************************************************************
+ * MST Decoder/Encoder for Sonic '06                                       *
+ * TextFuncsBench.cpp: Text conversion benchmark.                          *
+ *                                                                         *
+ * Copyright (c) 2019-2025 by David Korth.                                 *
+ * SPDX-License-Identifier: MIT                                            *
+ ***************************************************************************/
+
+// Measures the throughput of the TextFuncs.hpp conversion functions
+// on a message corpus, split into string length buckets.
+//
+// Usage: TextFuncsBench [-t seconds] [corpus.txt]
+//
+// corpus.txt is a UTF-8 text file with one message per line.
+// If it isn't specified, a synthetic corpus is generated, consisting
+// of ASCII message names, placeholder names, and English and Japanese
+// message text, which is roughly what Sonic '06 MST files contain.
+//
+// Functions marked "(OS)" are run with TEXTCONV_FLAG_NO_NATIVE, which
+// bypasses the native CP932 codec and uses iconv (or Win32) instead.
+// These are the baseline for the native codec.
+
+#include "TextFuncs.hpp"
+#include "byteorder.h"
+#include "common.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <cstdio>
+#include <cstring>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+using std::string;
+using std::u16string;
+using std::vector;
+
+// Minimum time to run each benchmark, in seconds.
+static double min_seconds = 0.25;
+
+// Prevents the compiler from optimizing out conversions.
+static volatile size_t sink;
+
+/**
+ * Simple deterministic random number generator. (LCG)
+ * @param state [in/out] RNG state.
+ * @param n Upper bound. (exclusive)
+ * @return Random number in [0, n).
+ */
+static inline unsigned int rng(uint32_t &state, unsigned int n)
+{
+	state = (state * 1103515245U) + 12345U;
+	return ((state >> 16) & 0x7FFF) % n;
+}
+
+/**
+ * Generate a synthetic message corpus.
+ * @param count Number of messages.
+ * @return Corpus. (UTF-8)
+ */
+static vector<string> generateCorpus(size_t count)
+{
+	static const char *const areas[] = {
+		"wvo", "dtd", "wap", "csc", "flc", "rct", "tpj", "kdv", "aqa", "end",
+	};
+	static const char *const placeholders[] = {
+		"button_a", "button_b", "button_x", "button_y", "button_start",
+		"button_lb", "button_rb", "stick_l", "stick_r", "rgb",
+	};
+	static const char *const en_words[] = {
+		"the", "Chaos", "Emerald", "Sonic", "Shadow", "Silver", "Eggman",
+		"Soleanna", "princess", "ring", "hurry", "press", "to", "jump",
+		"you", "can't", "escape", "from", "me", "now!", "Let's", "go.",
+	};
+	// Common kana and kanji, plus full-width punctuation.
+	static const char *const ja_chars[] = {
+		"\xE3\x81\x82", "\xE3\x81\x84", "\xE3\x81\x86", "\xE3\x81\x88", "\xE3\x81\x8A",
+		"\xE3\x81\x8B", "\xE3\x81\xAE", "\xE3\x81\xA7", "\xE3\x81\x99", "\xE3\x82\x8B",
+		"\xE3\x82\xBD", "\xE3\x83\x8B", "\xE3\x83\x83", "\xE3\x82\xAF", "\xE3\x83\xBC",
+		"\xE6\x97\xA5", "\xE6\x9C\xAC", "\xE4\xBA\xBA", "\xE5\xA4\xA7", "\xE7\x8E\x8B",
+		"\xE3\x80\x81", "\xE3\x80\x82", "\xEF\xBC\x81", "\xEF\xBD\x9E",
+	};
+
+	vector<string> corpus;
+	corpus.reserve(count);
+	uint32_t state = 0x5EC06;
+	char buf[64];
+	for (size_t i = 0; i < count; i++) {
+		string str;
+		switch (rng(state, 4)) {
+			case 0:
+				// Message name.
+				snprintf(buf, sizeof(buf), "msg_%s_%s%04u",
+					areas[rng(state, ARRAY_SIZE(areas))],
+					(rng(state, 2) ? "hint_" : ""),
+					rng(state, 10000));
+				str = buf;
+				break;
+			case 1:
+				// Placeholder name.
+				str = placeholders[rng(state, ARRAY_SIZE(placeholders))];
+				break;
+			case 2: {
+				// English message text.
+				const unsigned int words = 2 + rng(state, (rng(state, 4) == 0 ? 120 : 24));
+				for (unsigned int w = 0; w < words; w++) {
+					if (w != 0) {
+						str += (rng(state, 12) == 0 ? '\n' : ' ');
+					}
+					str += en_words[rng(state, ARRAY_SIZE(en_words))];
+				}
+				break;
+			}
+			default: {
+				// Japanese message text.
+				const unsigned int chars = 2 + rng(state, (rng(state, 4) == 0 ? 200 : 40));
+				for (unsigned int c = 0; c < chars; c++) {
+					str += ja_chars[rng(state, ARRAY_SIZE(ja_chars))];
+				}
+				break;
+			}
+		}
+		corpus.push_back(std::move(str));
+	}
+	return corpus;
+}
+
+/**
+ * Load a message corpus from a file.
+ * @param filename Filename. (UTF-8 text, one message per line)
+ * @param corpus [out] Corpus.
+ * @return True on success; false on error.
+ */
+static bool loadCorpus(const char *filename, vector<string> &corpus)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		return false;
+	}
+
+	string line;
+	char buf[4096];
+	size_t size;
+	while ((size = fread(buf, 1, sizeof(buf), f)) > 0) {
+		for (size_t i = 0; i < size; i++) {
+			if (buf[i] == '\n') {
+				if (!line.empty() && line[line.size()-1] == '\r') {
+					line.resize(line.size()-1);
+				}
+				if (!line.empty()) {
+					corpus.push_back(line);
+				}
+				line.clear();
+			} else {
+				line += buf[i];
+			}
+		}
+	}
+	if (!line.empty()) {
+		corpus.push_back(line);
+	}
+	fclose(f);
+	return true;
+}
+
+/**
+ * String length bucket.
+ * Strings are sorted into buckets by their UTF-8 length.
+ */
+struct Bucket {
+	Bucket(const char *name, size_t min_len, size_t max_len)
+		: name(name)
+		, min_len(min_len)
+		, max_len(max_len)
+	{ }
+
+	const char *name;
+	size_t min_len;
+	size_t max_len;
+
+	// Test data, in each encoding.
+	vector<string> utf8;
+	vector<string> sjis;
+	vector<u16string> utf16;	// host-endian
+	vector<u16string> utf16le;
+	vector<u16string> utf16be;
+
+	// Batch spans.
+	vector<TextSpan> utf8_spans;
+	vector<TextSpan> sjis_spans;
+	vector<TextSpan16> utf16be_spans;
+};
+
+/**
+ * Run a benchmark.
+ * @param func_name Function name.
+ * @param bucket Bucket.
+ * @param in_bytes Input size for one pass, in bytes.
+ * @param pass Function that converts every string in the bucket once.
+ */
+static void runBenchmark(const char *func_name, const Bucket &bucket, size_t in_bytes,
+	const std::function<void(void)> &pass)
+{
+	typedef std::chrono::steady_clock clock;
+	const size_t strings = bucket.utf8.size();
+	if (strings == 0) {
+		return;
+	}
+
+	// Warm up.
+	pass();
+
+	size_t passes = 0;
+	const clock::time_point start = clock::now();
+	double seconds;
+	do {
+		pass();
+		passes++;
+		seconds = std::chrono::duration<double>(clock::now() - start).count();
+	} while (seconds < min_seconds);
+
+	const double mb_per_sec = ((double)in_bytes * passes) / seconds / 1000000.0;
+	const double str_per_sec = ((double)strings * passes) / seconds;
+	printf("%-34s %-10s %8zu %10.1f %14.0f\n",
+		func_name, bucket.name, strings, mb_per_sec, str_per_sec);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *corpus_filename = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			min_seconds = atof(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "Syntax: %s [-t seconds] [corpus.txt]\n", argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			corpus_filename = argv[i];
+		}
+	}
+
+	vector<string> corpus;
+	if (corpus_filename) {
+		if (!loadCorpus(corpus_filename, corpus)) {
+			fprintf(stderr, "*** ERROR loading %s\n", corpus_filename);
+			return EXIT_FAILURE;
+		}
+	} else {
+		corpus = generateCorpus(20000);
+	}
+
+	// Sort the strings into buckets.
+	Bucket buckets[] = {
+		Bucket("1-16",	1,	16),
+		Bucket("17-64",	17,	64),
+		Bucket("65-256",	65,	256),
+		Bucket("257+",	257,	~(size_t)0),
+	};
+	for (auto iter = corpus.cbegin(); iter != corpus.cend(); ++iter) {
+		for (int b = 0; b < ARRAY_SIZE(buckets); b++) {
+			Bucket &bucket = buckets[b];
+			if (iter->size() < bucket.min_len || iter->size() > bucket.max_len)
+				continue;
+
+			bucket.utf8.push_back(*iter);
+			bucket.sjis.push_back(utf8_to_cpN(932, iter->data(), iter->size()));
+			const u16string wcs = utf8_to_utf16(*iter);
+			bucket.utf16.push_back(wcs);
+#if SYS_BYTEORDER == SYS_LIL_ENDIAN
+			bucket.utf16le.push_back(wcs);
+			bucket.utf16be.push_back(utf16_bswap(wcs.data(), wcs.size()));
+#else /* SYS_BYTEORDER == SYS_BIG_ENDIAN */
+			bucket.utf16le.push_back(utf16_bswap(wcs.data(), wcs.size()));
+			bucket.utf16be.push_back(wcs);
+#endif
+			break;
+		}
+	}
+
+	// Batch spans.
+	// NOTE: Done after all strings are added, since adding strings
+	// may reallocate the vectors.
+	size_t total_strings = 0;
+	for (int b = 0; b < ARRAY_SIZE(buckets); b++) {
+		Bucket &bucket = buckets[b];
+		total_strings += bucket.utf8.size();
+		for (size_t i = 0; i < bucket.utf8.size(); i++) {
+			const TextSpan utf8_span = {bucket.utf8[i].data(), bucket.utf8[i].size()};
+			const TextSpan sjis_span = {bucket.sjis[i].data(), bucket.sjis[i].size()};
+			const TextSpan16 utf16be_span = {bucket.utf16be[i].data(), bucket.utf16be[i].size()};
+			bucket.utf8_spans.push_back(utf8_span);
+			bucket.sjis_spans.push_back(sjis_span);
+			bucket.utf16be_spans.push_back(utf16be_span);
+		}
+	}
+
+	printf("Corpus: %s (%zu strings)\n\n",
+		(corpus_filename ? corpus_filename : "synthetic"), total_strings);
+	printf("%-34s %-10s %8s %10s %14s\n",
+		"Function", "Length", "Strings", "MB/s", "Strings/s");
+
+	for (int b = 0; b < ARRAY_SIZE(buckets); b++) {
+		const Bucket &bucket = buckets[b];
+		if (bucket.utf8.empty())
+			continue;
+
+		// Input sizes, in bytes.
+		size_t utf8_bytes = 0, sjis_bytes = 0, utf16_bytes = 0;
+		for (size_t i = 0; i < bucket.utf8.size(); i++) {
+			utf8_bytes += bucket.utf8[i].size();
+			sjis_bytes += bucket.sjis[i].size();
+			utf16_bytes += bucket.utf16[i].size() * sizeof(char16_t);
+		}
+
+		runBenchmark("cpN_to_utf8(932)", bucket, sjis_bytes, [&bucket]() {
+			for (auto iter = bucket.sjis.cbegin(); iter != bucket.sjis.cend(); ++iter) {
+				sink += cpN_to_utf8(932, iter->data(), iter->size()).size();
+			}
+		});
+		runBenchmark("cpN_to_utf8(932) (OS)", bucket, sjis_bytes, [&bucket]() {
+			for (auto iter = bucket.sjis.cbegin(); iter != bucket.sjis.cend(); ++iter) {
+				sink += cpN_to_utf8(932, iter->data(), iter->size(), TEXTCONV_FLAG_NO_NATIVE).size();
+			}
+		});
+		runBenchmark("cpN_to_utf8_batch(932)", bucket, sjis_bytes, [&bucket]() {
+			TextBatch out;
+			cpN_to_utf8_batch(932, bucket.sjis_spans.data(), bucket.sjis_spans.size(), out);
+			sink += out.data.size();
+		});
+		runBenchmark("cpN_to_utf16(932)", bucket, sjis_bytes, [&bucket]() {
+			for (auto iter = bucket.sjis.cbegin(); iter != bucket.sjis.cend(); ++iter) {
+				sink += cpN_to_utf16(932, iter->data(), iter->size()).size();
+			}
+		});
+		runBenchmark("cpN_to_utf16(932) (OS)", bucket, sjis_bytes, [&bucket]() {
+			for (auto iter = bucket.sjis.cbegin(); iter != bucket.sjis.cend(); ++iter) {
+				sink += cpN_to_utf16(932, iter->data(), iter->size(), TEXTCONV_FLAG_NO_NATIVE).size();
+			}
+		});
+		runBenchmark("utf8_to_cpN(932)", bucket, utf8_bytes, [&bucket]() {
+			for (auto iter = bucket.utf8.cbegin(); iter != bucket.utf8.cend(); ++iter) {
+				sink += utf8_to_cpN(932, iter->data(), iter->size()).size();
+			}
+		});
+		runBenchmark("utf8_to_cpN(932) (OS)", bucket, utf8_bytes, [&bucket]() {
+			for (auto iter = bucket.utf8.cbegin(); iter != bucket.utf8.cend(); ++iter) {
+				sink += utf8_to_cpN(932, iter->data(), iter->size(), TEXTCONV_FLAG_NO_NATIVE).size();
+			}
+		});
+		runBenchmark("utf8_to_cpN_batch(932)", bucket, utf8_bytes, [&bucket]() {
+			TextBatch out;
+			utf8_to_cpN_batch(932, bucket.utf8_spans.data(), bucket.utf8_spans.size(), out);
+			sink += out.data.size();
+		});
+
+		runBenchmark("cpN_to_utf8_batch(932) (OS)", bucket, sjis_bytes, [&bucket]() {
+			TextBatch out;
+			cpN_to_utf8_batch(932, bucket.sjis_spans.data(), bucket.sjis_spans.size(), out, TEXTCONV_FLAG_NO_NATIVE);
+			sink += out.data.size();
+		});
+		runBenchmark("utf8_to_cpN_batch(932) (OS)", bucket, utf8_bytes, [&bucket]() {
+			TextBatch out;
+			utf8_to_cpN_batch(932, bucket.utf8_spans.data(), bucket.utf8_spans.size(), out, TEXTCONV_FLAG_NO_NATIVE);
+			sink += out.data.size();
+		});
+
+		runBenchmark("utf16le_to_utf8", bucket, utf16_bytes, [&bucket]() {
+			for (auto iter = bucket.utf16le.cbegin(); iter != bucket.utf16le.cend(); ++iter) {
+				sink += utf16le_to_utf8(iter->data(), iter->size()).size();
+			}
+		});
+		runBenchmark("utf16be_to_utf8", bucket, utf16_bytes, [&bucket]() {
+			for (auto iter = bucket.utf16be.cbegin(); iter != bucket.utf16be.cend(); ++iter) {
+				sink += utf16be_to_utf8(iter->data(), iter->size()).size();
+			}
+		});
+		runBenchmark("utf16be_to_utf8_batch", bucket, utf16_bytes, [&bucket]() {
+			TextBatch out;
+			utf16be_to_utf8_batch(bucket.utf16be_spans.data(), bucket.utf16be_spans.size(), out);
+			sink += out.data.size();
+		});
+		runBenchmark("utf8_to_utf16", bucket, utf8_bytes, [&bucket]() {
+			for (auto iter = bucket.utf8.cbegin(); iter != bucket.utf8.cend(); ++iter) {
+				sink += utf8_to_utf16(iter->data(), iter->size()).size();
+			}
+		});
+		runBenchmark("utf16_bswap", bucket, utf16_bytes, [&bucket]() {
+			for (auto iter = bucket.utf16.cbegin(); iter != bucket.utf16.cend(); ++iter) {
+				sink += utf16_bswap(iter->data(), iter->size()).size();
+			}
+		});
+		printf("\n");
+	}
+
+	return EXIT_SUCCESS;
+}
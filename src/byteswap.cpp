@@ -0,0 +1,233 @@
+/***************************************************************************
+ * MST Decoder/Encoder for Sonic '06                                       *
+ * byteswap.cpp: Byteswapping functions.                                   *
+ *                                                                         *
+ * Copyright (c) 2008-2025 by David Korth.                                 *
+ * SPDX-License-Identifier: MIT                                            *
+ ***************************************************************************/
+
+#include "byteswap.h"
+
+// C++ includes.
+#include <atomic>
+
+// SIMD intrinsics.
+// The SSSE3 and AVX2 functions are compiled for their instruction sets
+// using function attributes, and are only called if the CPU supports them.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+# include <immintrin.h>
+# define BYTESWAP_HAVE_SIMD 1
+# define BYTESWAP_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+# include <intrin.h>
+# include <immintrin.h>
+# define BYTESWAP_HAVE_SIMD 1
+# define BYTESWAP_TARGET(x)
+#endif
+
+/** Standard (scalar) versions **/
+
+static void __byte_swap_16_array_c(uint16_t *dest, const uint16_t *src, size_t n)
+{
+	for (; n > 0; n--, dest++, src++) {
+		*dest = __swab16(*src);
+	}
+}
+
+static void __byte_swap_32_array_c(uint32_t *dest, const uint32_t *src, size_t n)
+{
+	for (; n > 0; n--, dest++, src++) {
+		*dest = __swab32(*src);
+	}
+}
+
+#ifdef BYTESWAP_HAVE_SIMD
+
+/** SSSE3 versions **/
+
+BYTESWAP_TARGET("ssse3")
+static void __byte_swap_16_array_ssse3(uint16_t *dest, const uint16_t *src, size_t n)
+{
+	const __m128i shuf = _mm_setr_epi8(1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14);
+	for (; n >= 8; n -= 8, dest += 8, src += 8) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm_shuffle_epi8(v, shuf));
+	}
+	__byte_swap_16_array_c(dest, src, n);
+}
+
+BYTESWAP_TARGET("ssse3")
+static void __byte_swap_32_array_ssse3(uint32_t *dest, const uint32_t *src, size_t n)
+{
+	const __m128i shuf = _mm_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+	for (; n >= 4; n -= 4, dest += 4, src += 4) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm_shuffle_epi8(v, shuf));
+	}
+	__byte_swap_32_array_c(dest, src, n);
+}
+
+/** AVX2 versions **/
+
+BYTESWAP_TARGET("avx2")
+static void __byte_swap_16_array_avx2(uint16_t *dest, const uint16_t *src, size_t n)
+{
+	// NOTE: vpshufb shuffles within each 128-bit lane.
+	const __m256i shuf = _mm256_setr_epi8(
+		1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14,
+		1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14);
+	for (; n >= 16; n -= 16, dest += 16, src += 16) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest), _mm256_shuffle_epi8(v, shuf));
+	}
+	__byte_swap_16_array_c(dest, src, n);
+}
+
+BYTESWAP_TARGET("avx2")
+static void __byte_swap_32_array_avx2(uint32_t *dest, const uint32_t *src, size_t n)
+{
+	// NOTE: vpshufb shuffles within each 128-bit lane.
+	const __m256i shuf = _mm256_setr_epi8(
+		3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+		3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+	for (; n >= 8; n -= 8, dest += 8, src += 8) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest), _mm256_shuffle_epi8(v, shuf));
+	}
+	__byte_swap_32_array_c(dest, src, n);
+}
+
+// CPU features used for dispatch.
+enum {
+	CPU_FLAG_SSSE3	= (1U << 0),
+	CPU_FLAG_AVX2	= (1U << 1),
+};
+
+/**
+ * Get the SIMD features supported by the CPU.
+ * @return CPU_FLAG_* bitfield.
+ */
+static unsigned int get_cpu_flags(void)
+{
+	unsigned int flags = 0;
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3"))
+		flags |= CPU_FLAG_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+		flags |= CPU_FLAG_AVX2;
+#elif defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0);
+	const int max_leaf = regs[0];
+	__cpuid(regs, 1);
+	if (regs[2] & (1 << 9))
+		flags |= CPU_FLAG_SSSE3;
+	// AVX2 also requires the OS to save the YMM registers. (OSXSAVE)
+	if (max_leaf >= 7 && (regs[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(regs, 7, 0);
+		if (regs[1] & (1 << 5))
+			flags |= CPU_FLAG_AVX2;
+	}
+#endif
+	return flags;
+}
+
+#endif /* BYTESWAP_HAVE_SIMD */
+
+typedef void (*byte_swap_16_array_fn)(uint16_t *dest, const uint16_t *src, size_t n);
+typedef void (*byte_swap_32_array_fn)(uint32_t *dest, const uint32_t *src, size_t n);
+
+/**
+ * Select the best 16-bit array byteswap function for this CPU.
+ * @return Function pointer.
+ */
+static byte_swap_16_array_fn select_byte_swap_16_array(void)
+{
+#ifdef BYTESWAP_HAVE_SIMD
+	const unsigned int flags = get_cpu_flags();
+	if (flags & CPU_FLAG_AVX2)
+		return __byte_swap_16_array_avx2;
+	if (flags & CPU_FLAG_SSSE3)
+		return __byte_swap_16_array_ssse3;
+#endif /* BYTESWAP_HAVE_SIMD */
+	return __byte_swap_16_array_c;
+}
+
+/**
+ * Select the best 32-bit array byteswap function for this CPU.
+ * @return Function pointer.
+ */
+static byte_swap_32_array_fn select_byte_swap_32_array(void)
+{
+#ifdef BYTESWAP_HAVE_SIMD
+	const unsigned int flags = get_cpu_flags();
+	if (flags & CPU_FLAG_AVX2)
+		return __byte_swap_32_array_avx2;
+	if (flags & CPU_FLAG_SSSE3)
+		return __byte_swap_32_array_ssse3;
+#endif /* BYTESWAP_HAVE_SIMD */
+	return __byte_swap_32_array_c;
+}
+
+static void byte_swap_16_array_resolve(uint16_t *dest, const uint16_t *src, size_t n);
+static void byte_swap_32_array_resolve(uint32_t *dest, const uint32_t *src, size_t n);
+
+// Selected byteswap functions.
+// NOTE: These are constant-initialized to the resolvers, which select
+// the real function on first call. Function-local statics can't be used
+// here, since MSVC builds disable thread-safe initialization of statics.
+static std::atomic<byte_swap_16_array_fn> byte_swap_16_array_impl(byte_swap_16_array_resolve);
+static std::atomic<byte_swap_32_array_fn> byte_swap_32_array_impl(byte_swap_32_array_resolve);
+
+/**
+ * Select the 16-bit array byteswap function, then call it.
+ * Concurrent first calls may both select it; the result is the same.
+ * @param dest	[out] Destination array.
+ * @param src	[in] Source array.
+ * @param n	[in] Number of elements.
+ */
+static void byte_swap_16_array_resolve(uint16_t *dest, const uint16_t *src, size_t n)
+{
+	const byte_swap_16_array_fn fn = select_byte_swap_16_array();
+	byte_swap_16_array_impl.store(fn, std::memory_order_relaxed);
+	fn(dest, src, n);
+}
+
+/**
+ * Select the 32-bit array byteswap function, then call it.
+ * Concurrent first calls may both select it; the result is the same.
+ * @param dest	[out] Destination array.
+ * @param src	[in] Source array.
+ * @param n	[in] Number of elements.
+ */
+static void byte_swap_32_array_resolve(uint32_t *dest, const uint32_t *src, size_t n)
+{
+	const byte_swap_32_array_fn fn = select_byte_swap_32_array();
+	byte_swap_32_array_impl.store(fn, std::memory_order_relaxed);
+	fn(dest, src, n);
+}
+
+/**
+ * Byteswap an array of 16-bit values.
+ * dest and src may point to the same array.
+ * @param dest	[out] Destination array.
+ * @param src	[in] Source array.
+ * @param n	[in] Number of elements.
+ */
+void __byte_swap_16_array(uint16_t *dest, const uint16_t *src, size_t n)
+{
+	byte_swap_16_array_impl.load(std::memory_order_relaxed)(dest, src, n);
+}
+
+/**
+ * Byteswap an array of 32-bit values.
+ * dest and src may point to the same array.
+ * @param dest	[out] Destination array.
+ * @param src	[in] Source array.
+ * @param n	[in] Number of elements.
+ */
+void __byte_swap_32_array(uint32_t *dest, const uint32_t *src, size_t n)
+{
+	byte_swap_32_array_impl.load(std::memory_order_relaxed)(dest, src, n);
+}
@@ -9,6 +9,7 @@
 #pragma once
 
 // C includes
+#include <stddef.h>
 #include <stdint.h>
 
 /* Byteswapping intrinsics */
@@ -93,3 +94,29 @@
 	#define cpu_to_le32(x)	__swab32(x)
 	#define cpu_to_le64(x)	__swab64(x)
 #endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Byteswap an array of 16-bit values.
+ * dest and src may point to the same array.
+ * @param dest	[out] Destination array.
+ * @param src	[in] Source array.
+ * @param n	[in] Number of elements.
+ */
+void __byte_swap_16_array(uint16_t *dest, const uint16_t *src, size_t n);
+
+/**
+ * Byteswap an array of 32-bit values.
+ * dest and src may point to the same array.
+ * @param dest	[out] Destination array.
+ * @param src	[in] Source array.
+ * @param n	[in] Number of elements.
+ */
+void __byte_swap_32_array(uint32_t *dest, const uint32_t *src, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
@@ -78,6 +78,13 @@
 #  endif
 #endif /* !defined(FORCEINLINE) */
 
+// SSE2 intrinsics.
+// NOTE: SSE2 is always available on amd64.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define HAVE_SSE2 1
+#endif
+
 // gcc branch prediction hints.
 // Should be used in combination with profile-guided optimization.
 #ifdef __GNUC__
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+# MST Decoder/Encoder for Sonic '06
+# gen_cp932_tables.py: Generate cp932_tables.h.
+#
+# Copyright (c) 2019-2025 by David Korth.
+# SPDX-License-Identifier: MIT
+#
+# Usage: python3 gen_cp932_tables.py > cp932_tables.h
+#
+# Python's cp932 codec follows Microsoft's CP932 mappings, including
+# the JIS-compatible encode-only mappings, e.g. U+301C WAVE DASH -> 0x8160.
+#
+# Adjustments to match Windows and glibc:
+# - The non-standard single-byte mappings (0x80, 0xA0, 0xFD-0xFF) are
+#   not included, since most iconv implementations reject them.
+# - Characters that are in both the NEC-selected IBM extensions
+#   (0xED-0xEE) and the IBM extensions (0xFA-0xFC) are encoded using
+#   the IBM extensions.
+# - A few best-fit mappings are added for encoding.
+
+import sys
+
+# Lead bytes: 0x81-0x9F, 0xE0-0xFC
+LEADS = list(range(0x81, 0xA0)) + list(range(0xE0, 0xFD))
+# Trail bytes: 0x40-0xFC (0x7F is never valid)
+TRAIL_MIN = 0x40
+TRAIL_MAX = 0xFC
+TRAIL_COUNT = TRAIL_MAX - TRAIL_MIN + 1
+
+def decode_tables():
+	tbl = []
+	for lead in LEADS:
+		row = []
+		for trail in range(TRAIL_MIN, TRAIL_MAX + 1):
+			try:
+				u = bytes([lead, trail]).decode('cp932')
+			except UnicodeDecodeError:
+				u = None
+			row.append(ord(u) if u and len(u) == 1 else 0)
+		tbl.append(row)
+	return tbl
+
+# Best-fit mappings for encoding.
+ENC_EXTRA = {
+	0x00A5: 0x5C,	# YEN SIGN -> REVERSE SOLIDUS
+	0x203E: 0x7E,	# OVERLINE -> TILDE
+	0x2014: 0x815C,	# EM DASH -> HORIZONTAL BAR
+}
+
+def encode_tables():
+	enc = {}
+	for c in range(0x80, 0x10000):
+		if 0xD800 <= c < 0xE000:
+			continue
+		try:
+			b = chr(c).encode('cp932')
+		except UnicodeEncodeError:
+			continue
+		if len(b) == 1:
+			if b[0] < 0xA1 or b[0] > 0xDF:
+				# Non-standard single-byte mapping.
+				continue
+			enc[c] = b[0]
+		else:
+			enc[c] = (b[0] << 8) | b[1]
+
+	# Prefer the IBM extensions over the NEC-selected IBM extensions.
+	for lead in range(0xFA, 0xFD):
+		for trail in range(TRAIL_MIN, TRAIL_MAX + 1):
+			try:
+				u = bytes([lead, trail]).decode('cp932')
+			except UnicodeDecodeError:
+				continue
+			c = ord(u)
+			if c in enc and 0xED <= (enc[c] >> 8) <= 0xEE:
+				enc[c] = (lead << 8) | trail
+
+	for c, sjis in ENC_EXTRA.items():
+		enc.setdefault(c, sjis)
+
+	pages = sorted(set(c >> 8 for c in enc))
+	page_idx = [0] * 256
+	page_data = []
+	for i, page in enumerate(pages):
+		page_idx[page] = i + 1
+		page_data.append([enc.get((page << 8) | lo, 0) for lo in range(256)])
+	return page_idx, page_data
+
+def write_array(out, values, per_line, fmt):
+	for i in range(0, len(values), per_line):
+		out.write('\t\t' + ', '.join(fmt % v for v in values[i:i+per_line]) + ',\n')
+
+def main():
+	out = sys.stdout
+	dec = decode_tables()
+	page_idx, page_data = encode_tables()
+
+	out.write('/***************************************************************************\n')
+	out.write(' * MST Decoder/Encoder for Sonic \'06                                       *\n')
+	out.write(' * cp932_tables.h: CP932 conversion tables.                                *\n')
+	out.write(' *                                                                         *\n')
+	out.write(' * Copyright (c) 2019-2025 by David Korth.                                 *\n')
+	out.write(' * SPDX-License-Identifier: MIT                                            *\n')
+	out.write(' ***************************************************************************/\n')
+	out.write('\n')
+	out.write('// NOTE: This file was generated by gen_cp932_tables.py. Do not edit!\n')
+	out.write('\n')
+	out.write('#pragma once\n')
+	out.write('\n')
+	out.write('#include <stdint.h>\n')
+	out.write('\n')
+	out.write('namespace CP932 {\n')
+	out.write('\n')
+	out.write('// Trail byte range.\n')
+	out.write('static constexpr uint8_t TRAIL_MIN = 0x%02X;\n' % TRAIL_MIN)
+	out.write('static constexpr uint8_t TRAIL_MAX = 0x%02X;\n' % TRAIL_MAX)
+	out.write('\n')
+	out.write('// Decoding table: CP932 to UTF-16.\n')
+	out.write('// - Row: Lead byte index. (0x81-0x9F, then 0xE0-0xFC)\n')
+	out.write('// - Column: Trail byte, minus TRAIL_MIN.\n')
+	out.write('// - Value: UTF-16 code point, or 0 if invalid.\n')
+	out.write('static constexpr uint16_t dec_tbl[%d][%d] = {\n' % (len(LEADS), TRAIL_COUNT))
+	for lead, row in zip(LEADS, dec):
+		out.write('\t// Lead byte 0x%02X\n' % lead)
+		out.write('\t{\n')
+		write_array(out, row, 12, '0x%04X')
+		out.write('\t},\n')
+	out.write('};\n')
+	out.write('\n')
+	out.write('// Encoding table index: UTF-16 high byte to enc_pages[] index, plus one.\n')
+	out.write('// 0 indicates no characters in this page can be encoded.\n')
+	out.write('static constexpr uint8_t enc_page_idx[256] = {\n')
+	write_array(out, page_idx, 16, '%3d')
+	out.write('};\n')
+	out.write('\n')
+	out.write('// Encoding table pages: UTF-16 low byte to CP932.\n')
+	out.write('// - Value: CP932 character (0x00xx for single-byte), or 0 if unmappable.\n')
+	out.write('static constexpr uint16_t enc_pages[%d][256] = {\n' % len(page_data))
+	for i, row in enumerate(page_data):
+		out.write('\t// U+%02Xxx\n' % page_idx.index(i + 1))
+		out.write('\t{\n')
+		write_array(out, row, 12, '0x%04X')
+		out.write('\t},\n')
+	out.write('};\n')
+	out.write('\n')
+	out.write('}\n')
+
+if __name__ == '__main__':
+	main()
@@ -21,6 +21,7 @@ using std::wstring;
 
 #include "tcharx.h"
 #include "Mst.hpp"
+#include "MstView.hpp"
 
 // for TinyXML2 error codes
 // TODO: Check ENABLE_XML?
@@ -33,8 +34,67 @@ using namespace tinyxml2;
 # define SLASH_CHAR '/'
 #endif
 
+/**
+ * Verify the differential offset tables of one or more MST files.
+ * @param argc Number of filenames.
+ * @param argv Filenames.
+ * @return EXIT_SUCCESS if all files are valid; EXIT_FAILURE if not.
+ */
+static int verifyFiles(int argc, TCHAR *argv[])
+{
+	int ret = EXIT_SUCCESS;
+	vector<string> vecErrs;
+	for (int i = 0; i < argc; i++) {
+		MstView view;
+		int err = view.open(argv[i]);
+		if (err != 0) {
+			_ftprintf(stderr, _T("*** ERROR loading %s: %s\n"), argv[i], _tcserror(-err));
+			ret = EXIT_FAILURE;
+			continue;
+		}
+
+		vecErrs.clear();
+		err = view.verify(&vecErrs);
+		if (err != 0) {
+			_tprintf(_T("%s: FAILED\n"), argv[i]);
+			for (auto iter = vecErrs.cbegin(); iter != vecErrs.cend(); ++iter) {
+				printf("- %s\n", iter->c_str());
+			}
+			ret = EXIT_FAILURE;
+		} else {
+			_tprintf(_T("%s: OK\n"), argv[i]);
+		}
+	}
+	return ret;
+}
+
 int _tmain(int argc, TCHAR *argv[])
 {
+	if (argc >= 3 && !_tcscmp(argv[1], _T("--verify"))) {
+		// Verify MST files.
+		return verifyFiles(argc - 2, &argv[2]);
+	}
+
+	// Large table mode allows MST files larger than 16 MB.
+	// String pooling stores identical strings only once when saving MST files,
+	// and suffix sharing also stores strings in the tails of other strings.
+	const TCHAR *const prog_name = argv[0];
+	unsigned int mst_load_flags = Mst::LOAD_FLAG_PARALLEL;
+	unsigned int mst_save_flags = 0;
+	while (argc >= 2) {
+		if (!_tcscmp(argv[1], _T("--large"))) {
+			mst_load_flags |= Mst::LOAD_FLAG_LARGE;
+		} else if (!_tcscmp(argv[1], _T("--pool"))) {
+			mst_save_flags |= Mst::SAVE_FLAG_POOL;
+		} else if (!_tcscmp(argv[1], _T("--suffix"))) {
+			mst_save_flags |= Mst::SAVE_FLAG_SUFFIX;
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
+
 	if (argc != 2 && argc != 3) {
 		_ftprintf(stderr,
 			_T("mst06 v1.0\n\n")
@@ -42,10 +102,20 @@ int _tmain(int argc, TCHAR *argv[])
 			_T("https://github.com/hyperbx/Marathon\n\n")
 			_T("Syntax: %s [filenames]\n\n")
 			_T("- Convert MST to XML: %s mst_file.mst [mst_file.xml]\n")
-			_T("- Convert XML to MST: %s mst_file.xml [mst_file.mst]\n\n")
+			_T("- Convert XML to MST: %s mst_file.xml [mst_file.mst]\n")
+			_T("- Verify MST offset tables: %s --verify mst_file.mst [...]\n\n")
+			_T("--verify only checks the file's structure: the offset\n")
+			_T("tables, and that each pointer points to a NULL-terminated\n")
+			_T("string. It does not check that the strings are correct.\n\n")
 			_T("Default output filename replaces the file extension on the\n")
-			_T("input file with .xml or .mst, depending on operation.\n")
-			, argv[0], argv[0], argv[0]);
+			_T("input file with .xml or .mst, depending on operation.\n\n")
+			_T("MST files larger than 16 MB are rejected unless --large\n")
+			_T("is specified before the filenames.\n\n")
+			_T("If --pool is specified before the filenames, identical\n")
+			_T("strings are only stored once when converting XML to MST.\n")
+			_T("If --suffix is specified, strings that are suffixes of\n")
+			_T("other strings share their tails. (Implies --pool.)\n")
+			, prog_name, prog_name, prog_name, prog_name);
 		return EXIT_FAILURE;
 	}
 
@@ -65,7 +135,23 @@ int _tmain(int argc, TCHAR *argv[])
 		_ftprintf(stderr, _T("*** ERROR reading file %s: %s\n"), argv[1], _tcserror(errno));
 		return EXIT_FAILURE;
 	}
-	rewind(f_in);
+
+	// Rewind the file so the loader can read it from the beginning.
+	// If the file isn't seekable (e.g. a pipe), read the rest of it into
+	// memory instead, prefixed with the bytes that were already read.
+	vector<uint8_t> in_data;
+	if (fseek(f_in, 0, SEEK_SET) != 0) {
+		in_data.assign(buf, buf + sizeof(buf));
+		uint8_t rdbuf[4096];
+		while ((size = fread(rdbuf, 1, sizeof(rdbuf), f_in)) > 0) {
+			in_data.insert(in_data.end(), rdbuf, rdbuf + size);
+		}
+		if (ferror(f_in)) {
+			fclose(f_in);
+			_ftprintf(stderr, _T("*** ERROR reading file %s: %s\n"), argv[1], _tcserror(EIO));
+			return EXIT_FAILURE;
+		}
+	}
 
 	Mst mst;
 	int ret;
@@ -81,14 +167,18 @@ int _tmain(int argc, TCHAR *argv[])
 		// Parse as XML and convert to MST.
 		out_ext = _T(".mst");
 		writeMST = true;
-		ret = mst.loadXML(f_in, &vecErrs);
+		ret = (in_data.empty()
+			? mst.loadXML(f_in, &vecErrs)
+			: mst.loadXML(in_data.data(), in_data.size(), &vecErrs));
 		fclose(f_in);
 	} else if (!memcmp(&buf[0x18], "BINA", 4)) {
 		// This is an MST file.
 		// Parse as MST and convert to XML.
 		out_ext = _T(".xml");
 		writeXML = true;
-		ret = mst.loadMST(f_in);
+		ret = (in_data.empty()
+			? mst.loadMST(f_in, mst_load_flags)
+			: mst.loadMST(in_data.data(), in_data.size(), mst_load_flags));
 		fclose(f_in);
 	} else {
 		// Unrecognized file format.
@@ -160,7 +250,7 @@ int _tmain(int argc, TCHAR *argv[])
 		_tprintf(_T("*** saveXML to %s: %d\n"), out_filename.c_str(), ret);
 	} else if (writeMST) {
 		// Convert to MST.
-		ret = mst.saveMST(out_filename.c_str());
+		ret = mst.saveMST(out_filename.c_str(), mst_save_flags);
 		_tprintf(_T("*** saveMST to %s: %d\n"), out_filename.c_str(), ret);
 	}
 	return ret;